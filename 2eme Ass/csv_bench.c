@@ -0,0 +1,502 @@
+// C99 -- gcc -std=c99 -O2 csv_bench.c -o csv_bench
+//
+// mesure csv_join sur des données synthétiques de taille croissante (cf. csv_gen) :
+// pour chaque taille de R2, génère R1 et R2, puis lance le join pour chaque budget
+// mémoire et chaque mode d'entrée/sortie ; écrit une ligne CSV par join (débit en
+// lignes et en octets par seconde, pic de mémoire résidente, nombre de scans de R2,
+// partitions) et vérifie le résultat contre le join de référence calculé par csv_gen
+
+#define _DEFAULT_SOURCE     // wait4
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#define BENCH_MAX_LIST 32           // tailles, budgets ou modes
+#define BENCH_MAX_ARGS 64           // arguments d'une commande
+#define BENCH_COPY_BUFFER (1 << 16)
+#define BENCH_PATH_SIZE (FILENAME_MAX + 1)
+
+// comment csv_join lit R2 et écrit le résultat
+typedef enum {
+    MODE_SYNC,      // -S : sans threads d'entrée/sortie
+    MODE_THREADS,   // threads de lecture et d'écriture (s'il y a plus d'un processeur)
+    MODE_PIPE       // R2 sur l'entrée standard, par un tube : lue une seule fois
+} BenchMode;
+
+// résultat de référence, écrit par csv_gen -e
+typedef struct {
+    uint64_t mRows1;
+    uint64_t mRows2;
+    uint64_t mBytes1;
+    uint64_t mBytes2;
+    uint64_t mRowsOut;
+    uint64_t mChecksum;
+} Expected;
+
+// mesures d'un join
+typedef struct {
+    int mStatus;            // code de sortie de csv_join, -1 s'il n'a pas fini normalement
+    double mSeconds;
+    long mPeakRss;          // Kio
+    uint64_t mBatches;      // lus dans les statistiques JSON de csv_join
+    uint64_t mPartitions;
+    uint64_t mRowsOut;      // lignes du fichier résultat
+    uint64_t mChecksum;
+} Run;
+
+//Prototypes
+
+uint64_t mix64(uint64_t);
+uint64_t line_hash(const char*, size_t);
+int parse_count(const char*, uint64_t*);
+size_t split_list(char*, char*[]);
+int parse_mode(const char*, BenchMode*);
+double now_seconds(void);
+pid_t spawn(char* const[], int, const char*);
+pid_t spawn_feeder(const char*, int*);
+int run_command(char* const[], const char*, const char*, Run*);
+int read_expected(const char*, Expected*);
+uint64_t json_field(const char*, const char*);
+int read_join_stats(const char*, Run*);
+int checksum_file(const char*, uint64_t*, uint64_t*);
+int generate(const char*, char*[], size_t, const char*, const char*, const char*, const char*, const char*);
+int bench_join(const char*, const char*, const char*, const char*, const char*, const char*, BenchMode,
+               const char*, Run*);
+void usage(const char*);
+
+/* ======================================================================
+ * Part I -- Checksums and parsing
+ * ======================================================================
+ */
+
+// fonction qui mélange les bits d'un mot (comme csv_gen)
+
+uint64_t mix64(uint64_t x){
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+// fonction qui hache une ligne comme csv_gen : la somme des hachages des lignes du
+// résultat ne dépend pas de leur ordre
+
+uint64_t line_hash(const char* line, size_t len){
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    size_t i;
+    for (i = 0; i < len; i++){
+        hash ^= (unsigned char) line[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return mix64(hash);
+}
+
+// fonction pour lire un nombre, suivi ou non de K, M, G ou T (puissances de 1024)
+// return 0 si réussit
+
+int parse_count(const char* s, uint64_t* v){
+    char* end = NULL;
+    unsigned long long value = strtoull(s, &end, 10);
+    if (*s == '\0' || *s == '-' || end == s)
+        return -1;
+    switch (*end){
+    case 'T': case 't': value <<= 10;   // fall through
+    case 'G': case 'g': value <<= 10;   // fall through
+    case 'M': case 'm': value <<= 10;   // fall through
+    case 'K': case 'k': value <<= 10;
+        end++;
+        break;
+    default:
+        break;
+    }
+    if (*end != '\0')
+        return -1;
+    *v = value;
+    return 0;
+}
+
+// fonction pour découper une liste "a,b,c" sur place
+// return le nombre d'éléments (au plus BENCH_MAX_LIST), 0 si la liste est trop longue
+
+size_t split_list(char* list, char* items[]){
+    size_t count = 0;
+    char* item;
+    for (item = strtok(list, ","); item != NULL; item = strtok(NULL, ",")){
+        if (count == BENCH_MAX_LIST)
+            return 0;
+        items[count++] = item;
+    }
+    return count;
+}
+
+// return 0 si réussit
+
+int parse_mode(const char* s, BenchMode* mode){
+    if (0 == strcmp(s, "sync"))         *mode = MODE_SYNC;
+    else if (0 == strcmp(s, "threads")) *mode = MODE_THREADS;
+    else if (0 == strcmp(s, "pipe"))    *mode = MODE_PIPE;
+    else return -1;
+    return 0;
+}
+
+/* ======================================================================
+ * Part II -- Processes
+ * ======================================================================
+ */
+
+double now_seconds(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// fonction pour lancer argv, l'entrée standard venant de input (-1 : /dev/null) et
+// les sorties standard et d'erreur allant à la fin du fichier log
+// return le pid, -1 si on ne peut pas lancer le processus
+
+pid_t spawn(char* const argv[], int input, const char* log){
+    pid_t pid = fork();
+    if (pid != 0)
+        return pid;
+    int in = input >= 0 ? input : open("/dev/null", O_RDONLY);
+    int out = open(log, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (in < 0 || out < 0 || dup2(in, STDIN_FILENO) < 0 || dup2(out, STDOUT_FILENO) < 0
+        || dup2(out, STDERR_FILENO) < 0)
+        _exit(127);
+    execv(argv[0], argv);
+    _exit(127);
+}
+
+// fonction pour lancer un processus qui recopie le fichier path dans un tube ;
+// *fd est le côté lecture du tube
+// return le pid, -1 si on ne peut pas
+
+pid_t spawn_feeder(const char* path, int* fd){
+    int pipe_fds[2];
+    if (0 != pipe(pipe_fds))
+        return -1;
+    pid_t pid = fork();
+    if (pid == 0){
+        char buffer[BENCH_COPY_BUFFER];
+        ssize_t n;
+        int in = open(path, O_RDONLY);
+        close(pipe_fds[0]);
+        if (in < 0)
+            _exit(1);
+        while ((n = read(in, buffer, sizeof(buffer))) > 0)
+            if (write(pipe_fds[1], buffer, n) != n)
+                _exit(1);
+        _exit(n == 0 ? 0 : 1);
+    }
+    close(pipe_fds[1]);
+    if (pid < 0){
+        close(pipe_fds[0]);
+        return -1;
+    }
+    *fd = pipe_fds[0];
+    return pid;
+}
+
+// fonction pour lancer argv et attendre sa fin, avec le fichier input recopié sur
+// son entrée standard par un tube (NULL : aucune entrée) ; mesure sa durée et son pic
+// de mémoire résidente
+// return 0 si le processus a pu être lancé
+
+int run_command(char* const argv[], const char* input, const char* log, Run* run){
+    int fd = -1, status = 0;
+    pid_t feeder = -1;
+    struct rusage resources;
+    if (input != NULL && (feeder = spawn_feeder(input, &fd)) < 0){
+        perror("pipe");
+        return -1;
+    }
+    double start = now_seconds();
+    pid_t pid = spawn(argv, fd, log);
+    if (fd >= 0)
+        close(fd);
+    if (pid < 0){
+        perror("fork");
+        if (feeder > 0){
+            kill(feeder, SIGTERM);
+            waitpid(feeder, NULL, 0);
+        }
+        return -1;
+    }
+    while (wait4(pid, &status, 0, &resources) < 0 && errno == EINTR)
+        ;
+    run->mSeconds = now_seconds() - start;
+    run->mPeakRss = resources.ru_maxrss;
+    run->mStatus = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    if (feeder > 0)
+        waitpid(feeder, NULL, 0);
+    return 0;
+}
+
+/* ======================================================================
+ * Part III -- Results
+ * ======================================================================
+ */
+
+// fonction pour lire le résultat de référence écrit par csv_gen -e
+// return 0 si réussit
+
+int read_expected(const char* path, Expected* expected){
+    FILE* f = fopen(path, "r");
+    if (f == NULL)
+        return -1;
+    int n = fscanf(f, "rows_r1 %" SCNu64 " rows_r2 %" SCNu64 " bytes_r1 %" SCNu64 " bytes_r2 %" SCNu64
+                   " rows_out %" SCNu64 " checksum %" SCNx64, &expected->mRows1, &expected->mRows2,
+                   &expected->mBytes1, &expected->mBytes2, &expected->mRowsOut, &expected->mChecksum);
+    fclose(f);
+    return n == 6 ? 0 : -1;
+}
+
+// fonction qui lit un nombre "name": N dans le JSON écrit par csv_join -J
+// return le nombre, 0 s'il manque
+
+uint64_t json_field(const char* json, const char* name){
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "\"%s\":", name);
+    const char* p = strstr(json, pattern);
+    return p == NULL ? 0 : strtoull(p + strlen(pattern), NULL, 10);
+}
+
+// fonction pour lire les statistiques JSON d'un join
+// return 0 si réussit
+
+int read_join_stats(const char* path, Run* run){
+    char json[4096];
+    FILE* f = fopen(path, "r");
+    if (f == NULL)
+        return -1;
+    size_t n = fread(json, 1, sizeof(json) - 1, f);
+    fclose(f);
+    json[n] = '\0';
+    run->mBatches = json_field(json, "batches");
+    run->mPartitions = json_field(json, "partitions");
+    return 0;
+}
+
+// fonction pour compter les lignes d'un résultat (sans l'en-tête) et en faire la
+// somme de contrôle
+// return 0 si réussit
+
+int checksum_file(const char* path, uint64_t* rows, uint64_t* checksum){
+    FILE* f = fopen(path, "r");
+    char* line = NULL;
+    size_t capacity = 0;
+    ssize_t len;
+    if (f == NULL)
+        return -1;
+    *rows = *checksum = 0;
+    if (getline(&line, &capacity, f) > 0){     // en-tête
+        while ((len = getline(&line, &capacity, f)) > 0){
+            if (line[len - 1] == '\n')
+                len--;
+            *checksum += line_hash(line, len);
+            (*rows)++;
+        }
+    }
+    free(line);
+    fclose(f);
+    return 0;
+}
+
+/* ======================================================================
+ * Part IV -- Benchmark
+ * ======================================================================
+ */
+
+// fonction pour générer R1 et R2 avec csv_gen : ses options (options, count), puis la
+// taille de R2 (size, en octets)
+// return 0 si réussit
+
+int generate(const char* gen, char* options[], size_t count, const char* size, const char* r1,
+             const char* r2, const char* expected, const char* log){
+    char* argv[BENCH_MAX_ARGS];
+    size_t n = 0, i;
+    Run run;
+    if (count + 8 > BENCH_MAX_ARGS)
+        return -1;
+    argv[n++] = (char*) gen;
+    for (i = 0; i < count; i++)
+        argv[n++] = options[i];
+    argv[n++] = "-b";
+    argv[n++] = (char*) size;
+    argv[n++] = "-e";
+    argv[n++] = (char*) expected;
+    argv[n++] = (char*) r1;
+    argv[n++] = (char*) r2;
+    argv[n] = NULL;
+    if (0 != run_command(argv, NULL, log, &run) || run.mStatus != 0){
+        fprintf(stderr, "%s a échoué (cf. %s)\n", gen, log);
+        return -1;
+    }
+    return 0;
+}
+
+// fonction pour lancer "csv_join R1 R2 OUT 0 1 budget" dans un mode, et faire la somme
+// de contrôle de son résultat
+// return 0 si le join a réussi
+
+int bench_join(const char* join, const char* r1, const char* r2, const char* out, const char* stats,
+               const char* budget, BenchMode mode, const char* log, Run* run){
+    char* argv[BENCH_MAX_ARGS];
+    size_t n = 0;
+    argv[n++] = (char*) join;
+    if (mode == MODE_SYNC)
+        argv[n++] = "-S";
+    argv[n++] = "-J";
+    argv[n++] = (char*) stats;
+    argv[n++] = (char*) r1;
+    argv[n++] = mode == MODE_PIPE ? "-" : (char*) r2;
+    argv[n++] = (char*) out;
+    argv[n++] = "0";
+    argv[n++] = "1";
+    argv[n++] = (char*) budget;
+    argv[n] = NULL;
+
+    memset(run, 0, sizeof(Run));
+    unlink(stats);
+    if (0 != run_command(argv, mode == MODE_PIPE ? r2 : NULL, log, run))
+        return -1;
+    if (run->mStatus != 0)
+        return -1;
+    if (0 != read_join_stats(stats, run) || 0 != checksum_file(out, &run->mRowsOut, &run->mChecksum))
+        return -1;
+    return 0;
+}
+
+void usage(const char* program)
+{
+    fprintf(stderr,
+            "usage : %s [-j CSV_JOIN] [-g CSV_GEN] [-d DIR] [-n SIZES] [-m BUDGETS] [-t MODES] [-k]\n"
+            "           [-- OPTIONS DE CSV_GEN]\n"
+            "  -j    programme de join (./csv_join par défaut)\n"
+            "  -g    générateur (./csv_gen par défaut)\n"
+            "  -d    répertoire des fichiers générés (. par défaut)\n"
+            "  -n    tailles de R2, en octets, séparées par des virgules (1M,16M,256M par défaut ;\n"
+            "        suffixes K, M, G et T)\n"
+            "  -m    budgets mémoire du join (256K,4M,64M par défaut)\n"
+            "  -t    modes du join parmi sync (-S), threads et pipe (R2 par un tube)\n"
+            "        (sync,threads,pipe par défaut)\n"
+            "  -k    garde les fichiers générés\n"
+            "  après --, les options sont passées à csv_gen (clés, Zipf, correspondances...)\n"
+            "  une ligne CSV par join sur la sortie standard : taille, budget, mode, secondes,\n"
+            "        lignes lues/s, octets lus/s, pic de mémoire résidente (Kio), lots (scans\n"
+            "        de R2 ou des partitions), partitions, lignes écrites, et yes si le résultat\n"
+            "        est celui du join de référence de csv_gen (no s'il diffère, failed si\n"
+            "        csv_join a échoué : cf. DIR/bench.log)\n",
+            program);
+}
+
+int main(int argc, char* argv[])
+{
+    const char* join = "./csv_join";
+    const char* gen = "./csv_gen";
+    const char* dir = ".";
+    char default_sizes[] = "1M,16M,256M", default_budgets[] = "256K,4M,64M",
+         default_modes[] = "sync,threads,pipe";
+    char* size_list = default_sizes, *budget_list = default_budgets, *mode_list = default_modes;
+    char* sizes[BENCH_MAX_LIST], *budgets[BENCH_MAX_LIST], *mode_names[BENCH_MAX_LIST];
+    BenchMode modes[BENCH_MAX_LIST];
+    size_t size_count, budget_count, mode_count, i, j, k;
+    uint64_t value;
+    int keep = 0, opt, bad = 0;
+
+    while ((opt = getopt(argc, argv, "j:g:d:n:m:t:k")) != -1) {
+        switch (opt) {
+        case 'j': join = optarg; break;
+        case 'g': gen = optarg; break;
+        case 'd': dir = optarg; break;
+        case 'n': size_list = optarg; break;
+        case 'm': budget_list = optarg; break;
+        case 't': mode_list = optarg; break;
+        case 'k': keep = 1; break;
+        default: bad = 1;
+        }
+    }
+    size_count = split_list(size_list, sizes);
+    budget_count = split_list(budget_list, budgets);
+    mode_count = split_list(mode_list, mode_names);
+    for (i = 0; i < size_count; i++)
+        bad |= parse_count(sizes[i], &value);
+    for (i = 0; i < mode_count; i++)
+        bad |= parse_mode(mode_names[i], &modes[i]);
+    if (bad || size_count == 0 || budget_count == 0 || mode_count == 0 || argc - optind + 8 > BENCH_MAX_ARGS) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // csv_join veut le budget en octets
+    char budget_bytes[BENCH_MAX_LIST][32];
+    for (i = 0; i < budget_count; i++){
+        if (0 != parse_count(budgets[i], &value)){
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        snprintf(budget_bytes[i], sizeof(budget_bytes[i]), "%" PRIu64, value);
+    }
+
+    char r1[BENCH_PATH_SIZE], r2[BENCH_PATH_SIZE], out[BENCH_PATH_SIZE], stats[BENCH_PATH_SIZE],
+         expected_path[BENCH_PATH_SIZE], log[BENCH_PATH_SIZE];
+    snprintf(r1, sizeof(r1), "%s/bench_r1.csv", dir);
+    snprintf(r2, sizeof(r2), "%s/bench_r2.csv", dir);
+    snprintf(out, sizeof(out), "%s/bench_out.csv", dir);
+    snprintf(stats, sizeof(stats), "%s/bench_stats.json", dir);
+    snprintf(expected_path, sizeof(expected_path), "%s/bench_expected.txt", dir);
+    snprintf(log, sizeof(log), "%s/bench.log", dir);
+
+    int failures = 0;
+    printf("size,budget,mode,seconds,rows_per_s,bytes_per_s,peak_rss_kb,batches,partitions,rows_out,ok\n");
+    for (i = 0; i < size_count; i++){
+        Expected expected;
+        if (0 != generate(gen, argv + optind, argc - optind, sizes[i], r1, r2, expected_path, log)
+            || 0 != read_expected(expected_path, &expected)){
+            failures++;
+            continue;
+        }
+        double rows = (double) (expected.mRows1 + expected.mRows2);
+        double bytes = (double) (expected.mBytes1 + expected.mBytes2);
+        for (j = 0; j < budget_count; j++){
+            for (k = 0; k < mode_count; k++){
+                Run run;
+                int success = bench_join(join, r1, r2, out, stats, budget_bytes[j], modes[k], log, &run);
+                int ok = success == 0 && run.mRowsOut == expected.mRowsOut && run.mChecksum == expected.mChecksum;
+                if (!ok)
+                    failures++;
+                if (success != 0)   // budget trop petit, par exemple : cf. le journal
+                    printf("%s,%s,%s,,,,,,,,failed\n", sizes[i], budgets[j], mode_names[k]);
+                else
+                    printf("%s,%s,%s,%.3f,%.0f,%.0f,%ld,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%s\n",
+                           sizes[i], budgets[j], mode_names[k], run.mSeconds, rows / run.mSeconds,
+                           bytes / run.mSeconds, run.mPeakRss, run.mBatches, run.mPartitions, run.mRowsOut,
+                           ok ? "yes" : "no");
+                fflush(stdout);
+                unlink(out);
+            }
+        }
+        if (!keep){
+            unlink(r1);
+            unlink(r2);
+        }
+    }
+    if (failures > 0)
+        fprintf(stderr, "%d join(s) en échec ou faux (cf. %s)\n", failures, log);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
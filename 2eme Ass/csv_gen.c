@@ -0,0 +1,474 @@
+// C99 -- gcc -std=c99 -O2 csv_gen.c -o csv_gen -lm
+//
+// génère deux relations CSV synthétiques pour mesurer csv_join (cf. csv_bench) :
+//   R1, la dimension : key,name,pad        join sur la colonne 0
+//   R2, les faits    : id,key,value,pad    join sur la colonne 1
+// avec -e, écrit aussi ce que doit donner "csv_join R1 R2 OUT 0 1 MEMOIRE" : le nombre
+// de lignes jointes et une somme de contrôle qui ne dépend pas de leur ordre
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <math.h>
+#include <unistd.h>
+
+#define GEN_MAX_WIDTH 1000          // csv_join lit des lignes de moins de 1024 octets
+#define GEN_LINE_SIZE (2 * GEN_MAX_WIDTH + 2)
+#define GEN_BUFFER (1 << 20)        // tampon stdio des fichiers générés
+#define GEN_DEFAULT_KEYS 100000
+#define GEN_DEFAULT_ROWS2 1000000
+
+typedef enum { GEN_INT, GEN_STRING } GenKeyType;
+
+// paramètres de la génération
+typedef struct {
+    uint64_t mRows1;        // lignes de R1 (key i % mKeys pour la ligne i)
+    uint64_t mKeys;         // keys distinctes de R1
+    uint64_t mRows2;        // lignes de R2, 0 : jusqu'à mBytes2 octets
+    uint64_t mBytes2;
+    size_t mWidth1;         // largeur visée des lignes, complétées par la colonne pad
+    size_t mWidth2;
+    double mZipf;           // exposant de la loi de Zipf des keys de R2 (0 : uniforme)
+    double mMatch;          // part des lignes de R2 dont la key est dans R1
+    double mSorted;         // part des lignes de R2 qui arrivent dans l'ordre des keys
+    uint64_t mSeed;
+    GenKeyType mKeyType;
+} GenOptions;
+
+// générateur pseudo-aléatoire xorshift64*
+typedef struct {
+    uint64_t mState;
+} Random;
+
+// loi de Zipf sur 1..mCount, tirée par rejet-inversion (Hörmann et Derflinger) :
+// temps constant par tirage, sans table des probabilités
+typedef struct {
+    double mExponent;
+    uint64_t mCount;
+    double mIntegralX1;
+    double mIntegralN;
+    double mS;
+} Zipf;
+
+// ce que doit écrire csv_join
+typedef struct {
+    uint64_t mRows1;
+    uint64_t mRows2;
+    uint64_t mBytes1;
+    uint64_t mBytes2;
+    uint64_t mRowsOut;
+    uint64_t mChecksum;     // somme (modulo 2^64) de line_hash de chaque ligne jointe
+} Expected;
+
+//Prototypes
+
+uint64_t mix64(uint64_t);
+void init_Random(Random*, uint64_t);
+uint64_t next_random(Random*);
+double random_unit(Random*);
+uint64_t line_hash(const char*, size_t);
+double zipf_h(const Zipf*, double);
+double zipf_integral(const Zipf*, double);
+double zipf_integral_inverse(const Zipf*, double);
+void init_Zipf(Zipf*, double, uint64_t);
+uint64_t sample_Zipf(const Zipf*, Random*);
+size_t format_key(char*, GenKeyType, uint64_t);
+size_t pad_row(char*, size_t, size_t, uint64_t);
+size_t r1_row(char*, const GenOptions*, uint64_t);
+size_t r2_row(char*, const GenOptions*, uint64_t, uint64_t, size_t*);
+uint64_t choose_key(const GenOptions*, const Zipf*, Random*, uint64_t*, uint64_t*);
+int write_r1(FILE*, const GenOptions*, Expected*);
+int write_r2(FILE*, const GenOptions*, Expected*);
+int write_expected(const char*, const Expected*);
+int parse_count(const char*, uint64_t*);
+int parse_fraction(const char*, double*);
+void usage(const char*);
+
+/* ======================================================================
+ * Part I -- Random numbers and Zipf distribution
+ * ======================================================================
+ */
+
+// fonction qui mélange les bits d'un mot (finaliseur de splitmix64)
+
+uint64_t mix64(uint64_t x){
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+// fonction pour initialiser le générateur (l'état ne doit pas être nul)
+
+void init_Random(Random* random, uint64_t seed){
+    random->mState = mix64(seed + 0x9e3779b97f4a7c15ULL);
+    if (random->mState == 0)
+        random->mState = 1;
+}
+
+uint64_t next_random(Random* random){
+    random->mState ^= random->mState >> 12;
+    random->mState ^= random->mState << 25;
+    random->mState ^= random->mState >> 27;
+    return random->mState * 0x2545f4914f6cdd1dULL;
+}
+
+// return un réel uniforme dans [0, 1)
+
+double random_unit(Random* random){
+    return (next_random(random) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// fonction qui hache une ligne (FNV-1a puis mix64) pour la somme de contrôle ;
+// csv_bench calcule la même chose sur chaque ligne du résultat
+
+uint64_t line_hash(const char* line, size_t len){
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    size_t i;
+    for (i = 0; i < len; i++){
+        hash ^= (unsigned char) line[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return mix64(hash);
+}
+
+// h(x) = x^-s, la densité continue qui majore la loi de Zipf
+
+double zipf_h(const Zipf* zipf, double x){
+    return exp(-zipf->mExponent * log(x));
+}
+
+// primitive de h : (x^(1-s) - 1) / (1 - s), log(x) si s = 1
+
+double zipf_integral(const Zipf* zipf, double x){
+    double log_x = log(x);
+    double t = (1 - zipf->mExponent) * log_x;
+    return (fabs(t) > 1e-8 ? expm1(t) / t : 1 + t / 2) * log_x;
+}
+
+// réciproque de zipf_integral
+
+double zipf_integral_inverse(const Zipf* zipf, double x){
+    double t = x * (1 - zipf->mExponent);
+    if (t < -1)
+        t = -1;     // erreurs d'arrondi
+    return exp((fabs(t) > 1e-8 ? log1p(t) / t : 1 - t / 2) * x);
+}
+
+void init_Zipf(Zipf* zipf, double exponent, uint64_t count){
+    zipf->mExponent = exponent;
+    zipf->mCount = count;
+    zipf->mIntegralX1 = zipf_integral(zipf, 1.5) - 1;
+    zipf->mIntegralN = zipf_integral(zipf, count + 0.5);
+    zipf->mS = 2 - zipf_integral_inverse(zipf, zipf_integral(zipf, 2.5) - zipf_h(zipf, 2));
+}
+
+// return un rang dans 1..mCount, le rang k ayant une probabilité proportionnelle à k^-s
+
+uint64_t sample_Zipf(const Zipf* zipf, Random* random){
+    if (zipf->mExponent <= 0)
+        return 1 + next_random(random) % zipf->mCount;
+    for (;;){
+        double u = zipf->mIntegralN + random_unit(random) * (zipf->mIntegralX1 - zipf->mIntegralN);
+        double x = zipf_integral_inverse(zipf, u);
+        double k = floor(x + 0.5);
+        if (k < 1)
+            k = 1;
+        else if (k > (double) zipf->mCount)
+            k = (double) zipf->mCount;
+        if (k - x <= zipf->mS || u >= zipf_integral(zipf, k + 0.5) - zipf_h(zipf, k))
+            return (uint64_t) k;
+    }
+}
+
+/* ======================================================================
+ * Part II -- Rows
+ * ======================================================================
+ */
+
+// fonction pour écrire une key dans s : l'entier, ou une chaîne de 13 octets
+// (au-delà des 7 octets que csv_join range dans le mot de la key : elle passe par
+// son dictionnaire)
+// return la longueur écrite
+
+size_t format_key(char* s, GenKeyType type, uint64_t key){
+    if (type == GEN_INT)
+        return sprintf(s, "%" PRIu64, key);
+    return sprintf(s, "k%012" PRIx64, key);
+}
+
+// fonction pour compléter une ligne de len octets jusqu'à width avec ",pad" (des
+// lettres tirées de seed) ; la colonne est vide si la ligne est déjà assez longue
+// return la nouvelle longueur
+
+size_t pad_row(char* line, size_t len, size_t width, uint64_t seed){
+    uint64_t bits = 0;
+    size_t i;
+    line[len++] = ',';
+    for (i = 0; len < width; i++){
+        if (i % 12 == 0)
+            bits = mix64(mix64(seed) + i + 1);
+        line[len++] = 'a' + bits % 26;
+        bits /= 26;
+    }
+    line[len] = '\0';
+    return len;
+}
+
+// fonction pour écrire la ligne i de R1 (sans '\n')
+// return sa longueur
+
+size_t r1_row(char* line, const GenOptions* options, uint64_t i){
+    size_t len = format_key(line, options->mKeyType, i % options->mKeys);
+    len += sprintf(line + len, ",n%" PRIu64, i);
+    return pad_row(line, len, options->mWidth1, i);
+}
+
+// fonction pour écrire la ligne id de R2, de key key (sans '\n') ; *rest est la
+// position de ce qui suit la key, que csv_join recopie après la ligne de R1
+// return sa longueur
+
+size_t r2_row(char* line, const GenOptions* options, uint64_t id, uint64_t key, size_t* rest){
+    size_t len = sprintf(line, "%" PRIu64 ",", id);
+    len += format_key(line + len, options->mKeyType, key);
+    *rest = len;
+    len += sprintf(line + len, ",%" PRIu64, mix64(id) % 1000000);
+    return pad_row(line, len, options->mWidth2, ~id);
+}
+
+// fonction qui tire la key d'une ligne de R2 : dans R1 (0..mKeys-1) avec la
+// probabilité mMatch, hors de R1 sinon ; avec la probabilité mSorted, c'est la key
+// qui suit la précédente (cursor), sinon une key de rang tiré par la loi de Zipf
+// (les keys hors de R1 sont alors uniformes)
+
+uint64_t choose_key(const GenOptions* options, const Zipf* zipf, Random* random, uint64_t* cursor,
+                    uint64_t* miss_cursor){
+    int match = random_unit(random) < options->mMatch;
+    int sorted = options->mSorted > 0 && random_unit(random) < options->mSorted;
+    if (match){
+        if (sorted)
+            return (*cursor)++ % options->mKeys;
+        return sample_Zipf(zipf, random) - 1;
+    }
+    if (sorted)
+        return options->mKeys + (*miss_cursor)++;
+    return options->mKeys + next_random(random) % (options->mKeys * 16 + 1);
+}
+
+/* ======================================================================
+ * Part III -- Files
+ * ======================================================================
+ */
+
+// fonction pour écrire R1 dans f
+// return 0 si réussit
+
+int write_r1(FILE* f, const GenOptions* options, Expected* expected){
+    char line[GEN_LINE_SIZE];
+    uint64_t i;
+    expected->mBytes1 = fprintf(f, "key,name,pad\n");
+    for (i = 0; i < options->mRows1; i++){
+        size_t len = r1_row(line, options, i);
+        line[len++] = '\n';
+        if (fwrite(line, 1, len, f) != len)
+            return -1;
+        expected->mBytes1 += len;
+    }
+    expected->mRows1 = options->mRows1;
+    return 0;
+}
+
+// fonction pour écrire R2 dans f, et calculer ce que le join doit donner : chaque
+// ligne de R2 dont la key est dans R1 est jointe aux lignes i = key, key + mKeys, ...
+// de R1
+// return 0 si réussit
+
+int write_r2(FILE* f, const GenOptions* options, Expected* expected){
+    char line[GEN_LINE_SIZE], joined[2 * GEN_LINE_SIZE];
+    Random random;
+    Zipf zipf;
+    uint64_t id, cursor = 0, miss_cursor = 0;
+    init_Random(&random, options->mSeed);
+    init_Zipf(&zipf, options->mZipf, options->mKeys);
+
+    expected->mBytes2 = fprintf(f, "id,key,value,pad\n");
+    for (id = 0; options->mRows2 > 0 ? id < options->mRows2 : expected->mBytes2 < options->mBytes2; id++){
+        uint64_t key = choose_key(options, &zipf, &random, &cursor, &miss_cursor), i;
+        size_t rest, len = r2_row(line, options, id, key, &rest);
+        for (i = key; key < options->mKeys && i < options->mRows1; i += options->mKeys){
+            size_t n = r1_row(joined, options, i);
+            n += sprintf(joined + n, ",%.*s", (int) strcspn(line, ","), line);    // id
+            memcpy(joined + n, line + rest, len - rest);               // ,value,pad
+            n += len - rest;
+            expected->mChecksum += line_hash(joined, n);
+            expected->mRowsOut++;
+        }
+        line[len++] = '\n';
+        if (fwrite(line, 1, len, f) != len)
+            return -1;
+        expected->mBytes2 += len;
+    }
+    expected->mRows2 = id;
+    return 0;
+}
+
+// fonction pour écrire le résultat attendu dans path, une valeur par ligne
+// return 0 si réussit
+
+int write_expected(const char* path, const Expected* expected){
+    FILE* f = fopen(path, "w");
+    if (f == NULL){
+        fprintf(stderr, "On ne peut pas créer %s\n", path);
+        return -1;
+    }
+    fprintf(f, "rows_r1 %" PRIu64 "\nrows_r2 %" PRIu64 "\nbytes_r1 %" PRIu64 "\nbytes_r2 %" PRIu64 "\n"
+            "rows_out %" PRIu64 "\nchecksum %016" PRIx64 "\n", expected->mRows1, expected->mRows2,
+            expected->mBytes1, expected->mBytes2, expected->mRowsOut, expected->mChecksum);
+    if (0 != fclose(f)){
+        fprintf(stderr, "On ne peut pas écrire %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+/* ======================================================================
+ * Part IV -- Main
+ * ======================================================================
+ */
+
+// fonction pour lire un nombre, suivi ou non de K, M, G ou T (puissances de 1024)
+// return 0 si réussit
+
+int parse_count(const char* s, uint64_t* v){
+    char* end = NULL;
+    unsigned long long value = strtoull(s, &end, 10);
+    if (*s == '\0' || *s == '-' || end == s)
+        return -1;
+    switch (*end){
+    case 'T': case 't': value <<= 10;   // fall through
+    case 'G': case 'g': value <<= 10;   // fall through
+    case 'M': case 'm': value <<= 10;   // fall through
+    case 'K': case 'k': value <<= 10;
+        end++;
+        break;
+    default:
+        break;
+    }
+    if (*end != '\0')
+        return -1;
+    *v = value;
+    return 0;
+}
+
+// fonction pour lire un réel positif ou nul
+// return 0 si réussit
+
+int parse_fraction(const char* s, double* v){
+    char* end = NULL;
+    double value = strtod(s, &end);
+    if (end == s || *end != '\0' || !(value >= 0))
+        return -1;
+    *v = value;
+    return 0;
+}
+
+void usage(const char* program)
+{
+    fprintf(stderr,
+            "usage : %s [-k KEYS] [-r ROWS1] [-n ROWS2 | -b BYTES2] [-w WIDTH1] [-W WIDTH2]\n"
+            "           [-z ZIPF] [-m MATCH] [-o SORTED] [-t int|string] [-S SEED] [-e EXPECTED] R1 R2\n"
+            "  -k    keys distinctes dans R1 (%d par défaut)\n"
+            "  -r    lignes de R1, la ligne i ayant la key i %% KEYS (KEYS par défaut)\n"
+            "  -n    lignes de R2 (%d par défaut)\n"
+            "  -b    taille de R2 en octets, à la place de -n\n"
+            "        (les nombres acceptent les suffixes K, M, G et T)\n"
+            "  -w    largeur des lignes de R1 en octets (32 par défaut, au plus %d)\n"
+            "  -W    largeur des lignes de R2 en octets (32 par défaut, au plus %d)\n"
+            "  -z    exposant de la loi de Zipf des keys de R2 (0 par défaut : uniforme)\n"
+            "  -m    part des lignes de R2 dont la key est dans R1 (1 par défaut)\n"
+            "  -o    part des lignes de R2 rangées dans l'ordre des keys (0 par défaut)\n"
+            "  -t    keys entières (par défaut) ou chaînes de 13 octets\n"
+            "  -S    graine du générateur (1 par défaut)\n"
+            "  -e    écrit dans EXPECTED le nombre de lignes et la somme de contrôle\n"
+            "        du join \"csv_join R1 R2 OUT 0 1 MEMOIRE\"\n",
+            program, GEN_DEFAULT_KEYS, GEN_DEFAULT_ROWS2, GEN_MAX_WIDTH, GEN_MAX_WIDTH);
+}
+
+int main(int argc, char* argv[])
+{
+    GenOptions options = { 0, GEN_DEFAULT_KEYS, GEN_DEFAULT_ROWS2, 0, 32, 32, 0, 1, 0, 1, GEN_INT };
+    Expected expected = { 0, 0, 0, 0, 0, 0 };
+    const char* expected_path = NULL;
+    uint64_t width = 0;
+    int opt, bad = 0;
+
+    while ((opt = getopt(argc, argv, "k:r:n:b:w:W:z:m:o:t:S:e:")) != -1) {
+        switch (opt) {
+        case 'k': bad |= parse_count(optarg, &options.mKeys) != 0 || options.mKeys == 0; break;
+        case 'r': bad |= parse_count(optarg, &options.mRows1) != 0; break;
+        case 'n': bad |= parse_count(optarg, &options.mRows2) != 0 || options.mRows2 == 0; break;
+        case 'b':
+            bad |= parse_count(optarg, &options.mBytes2) != 0;
+            options.mRows2 = 0;
+            break;
+        case 'w':
+        case 'W':
+            bad |= parse_count(optarg, &width) != 0 || width > GEN_MAX_WIDTH;
+            *(opt == 'w' ? &options.mWidth1 : &options.mWidth2) = (size_t) width;
+            break;
+        case 'z': bad |= parse_fraction(optarg, &options.mZipf); break;
+        case 'm': bad |= parse_fraction(optarg, &options.mMatch) != 0 || options.mMatch > 1; break;
+        case 'o': bad |= parse_fraction(optarg, &options.mSorted) != 0 || options.mSorted > 1; break;
+        case 'S': bad |= parse_count(optarg, &options.mSeed); break;
+        case 'e': expected_path = optarg; break;
+        case 't':
+            if (0 == strcmp(optarg, "int"))         options.mKeyType = GEN_INT;
+            else if (0 == strcmp(optarg, "string")) options.mKeyType = GEN_STRING;
+            else bad = 1;
+            break;
+        default:
+            bad = 1;
+        }
+    }
+    if (bad || argc - optind != 2) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (options.mRows1 == 0)
+        options.mRows1 = options.mKeys;
+    if (options.mRows1 < options.mKeys)
+        options.mKeys = options.mRows1;     // les keys distinctes que R1 contient vraiment
+
+    FILE* r1 = fopen(argv[optind], "w");
+    FILE* r2 = fopen(argv[optind + 1], "w");
+    if (r1 == NULL || r2 == NULL) {
+        fprintf(stderr, "On ne peut pas créer %s ou %s\n", argv[optind], argv[optind + 1]);
+        if (r1 != NULL) fclose(r1);
+        if (r2 != NULL) fclose(r2);
+        return EXIT_FAILURE;
+    }
+    setvbuf(r1, NULL, _IOFBF, GEN_BUFFER);
+    setvbuf(r2, NULL, _IOFBF, GEN_BUFFER);
+
+    int success = write_r1(r1, &options, &expected);
+    if (success == 0)
+        success = write_r2(r2, &options, &expected);
+    if (0 != fclose(r1) || 0 != fclose(r2))
+        success = -1;
+    if (success != 0)
+        fprintf(stderr, "On ne peut pas écrire %s ou %s\n", argv[optind], argv[optind + 1]);
+    else if (expected_path != NULL)
+        success = write_expected(expected_path, &expected);
+
+    if (success == 0)
+        fprintf(stderr, "R1 : %" PRIu64 " lignes, %" PRIu64 " octets ; R2 : %" PRIu64 " lignes, %" PRIu64
+                " octets ; join : %" PRIu64 " lignes\n", expected.mRows1, expected.mBytes1,
+                expected.mRows2, expected.mBytes2, expected.mRowsOut);
+    return success == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
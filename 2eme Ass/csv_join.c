@@ -1,45 +1,571 @@
-// C99
+// C99 -- gcc -std=c99 -pthread csv_join.c hashtable.c -o csv_join -lz
+//        (-DCSV_JOIN_NO_THREADS pour une version sans threads d'entrée/sortie,
+//         -DCSV_JOIN_NO_PROFILE -DHTABLE_NO_STATS pour retirer les chronomètres et
+//         l'histogramme des sondes)
+
+#define _POSIX_C_SOURCE 200809L
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <zlib.h>
+#ifndef CSV_JOIN_NO_THREADS
+#include <pthread.h>
+#endif
+
+#include "hashtable.h"
 
-#define HASH_TABLE_LOAD_FACTOR 0.75
 #define CSV_MAX_LINE_SIZE 1024
 #define CSV_SEPARATOR ','
 
+// mémoire fixe du join : tampons de ligne de read_row (les tampons des fichiers
+// dépendent du mode de lecture, cf. reader_footprint)
+#define JOIN_LINE_OVERHEAD (2 * (CSV_MAX_LINE_SIZE + 1))
+// blocs des threads de lecture et d'écriture : alignés sur une page, entre une page
+// et IO_MAX_BLOCK selon le budget
+#define IO_ALIGNMENT 4096
+#define IO_MAX_BLOCK (1 << 20)
+// entrées compressées : un membre bgzip fait au plus 64 Kio, compressé ou non
+#define BGZF_HEADER_SIZE 18
+#define BGZF_FOOTER_SIZE 8
+#define BGZF_MAX_MEMBER 65536
+#define BGZF_MAX_WORKERS 8
+#define INFLATE_MEMORY (40 * 1024)     // état de inflate et sa fenêtre de 32 Kio
+// partitions sur disque quand R2 ne peut être relue (tube, entrée standard)
+#define SPILL_MIN_PARTITIONS 2
+#define SPILL_MAX_PARTITIONS 256
+#define SPILL_DEFAULT_PARTITIONS 16     // si on ne connaît pas la taille de R1
+#define SPILL_MIN_BUFFER 64             // tampon stdio minimal d'un fichier temporaire
+#define SPILL_MAX_LEVELS 4              // répartitions successives d'une partition trop grosse
+// keys très fréquentes de R2 (heavy hitters), repérées avant de la répartir
+#define HEAVY_MAX_KEYS 16               // candidates suivies dans l'échantillon
+#define HEAVY_SAMPLE_ROWS 65536         // lignes au plus dans l'échantillon du début de R2
+#define SKETCH_DEPTH 4                  // lignes du count-min sketch
+#define SKETCH_MIN_WIDTH 64
+#define SKETCH_MAX_WIDTH (1 << 16)
+
+// keys de 7 octets au plus : rangées directement dans le mot de 64 bits
+#define KEY_INLINE_MAX 7
+
+// une key de join encodée sur 64 bits :
+//  - un entier (KEY_INT),
+//  - une chaîne courte : ses octets + (longueur + 1) dans l'octet de poids fort,
+//  - une chaîne longue : son code dans le dictionnaire (octet de poids fort à 0).
+typedef htable_key key_word;
+
+typedef enum { KEY_AUTO, KEY_INT, KEY_STRING } KeyType;
+
+// dictionnaire des chaînes longues : code -> chaîne, et adressage ouvert chaîne -> code
+typedef struct {
+    char** mStrings;
+    size_t mCount;
+    size_t mCapacity;   // taille de mStrings
+    uint32_t* mSlots;   // code + 1, 0 si la case est vide
+    size_t mSlotCount;  // puissance de 2
+    size_t mBytes;      // octets alloués (tableaux + copies des chaînes)
+} Dictionary;
+
+// comment encoder les keys d'un join
+typedef struct {
+    KeyType mType;      // KEY_AUTO tant qu'on n'a vu aucune key
+    int mAuto;          // type déduit des données : on peut repasser en chaînes
+    Dictionary mDict;
+} KeyCodec;
+
+// index persistant d'un fichier CSV sur une colonne (fichier créé par build_index)
+// toutes les positions sont des offsets depuis le début du fichier : il peut être
+// projeté en mémoire n'importe où et sondé directement, sans reconstruction
+#define INDEX_MAGIC "CSVJIDX3"
+
+typedef struct {
+    char mMagic[8];
+    uint64_t mFileSize;         // taille du fichier index
+    uint64_t mSourceSize;       // taille et date du CSV indexé, pour détecter un index périmé
+    int64_t mSourceMtime;
+    int64_t mSourceMtimeNsec;
+    uint64_t mColumn;           // colonne indexée
+    uint32_t mKeyType;          // KEY_INT ou KEY_STRING
+    uint32_t mKeyAuto;          // 1 si les entiers sont canoniques (type déduit)
+    uint64_t mBucketCount;
+    uint64_t mEntryCount;       // keys distinctes
+    uint64_t mRowCount;         // lignes indexées
+    uint64_t mDictCount;
+    uint64_t mDictSlotCount;
+    uint64_t mBucketsOffset;    // uint64_t[mBucketCount] : indice de la 1re entrée + 1, 0 si vide
+    uint64_t mEntriesOffset;    // IndexEntry[mEntryCount]
+    uint64_t mDictOffset;       // uint64_t[mDictCount] : offset de la chaîne de chaque code
+    uint64_t mDictSlotsOffset;  // uint32_t[mDictSlotCount] : code + 1, comme Dictionary.mSlots
+    uint64_t mHeaderRowOffset;  // en-tête du CSV, puis les lignes, terminées par '\0'
+} IndexHeader;
+
+typedef struct {
+    key_word mKey;
+    uint64_t mNext;             // indice de l'entrée suivante + 1, 0 en fin de chaîne
+    uint64_t mRow;              // offset de la 1re ligne de la key
+    uint64_t mRowCount;         // lignes de la key, rangées à la suite (séparées par '\0')
+} IndexEntry;
+
+// index projeté en mémoire
+typedef struct {
+    const char* mBase;
+    size_t mSize;
+    const IndexHeader* mHeader;
+} MappedIndex;
+
+// cache colonnes d'un fichier CSV, rangé à côté de lui ("<fichier>.cols")
+// une colonne d'entiers canoniques est stockée en entiers de 1, 2, 4 ou 8 octets ; une
+// colonne de chaînes est encodée par dictionnaire (un code uint32_t par ligne) si ses
+// valeurs se répètent assez pour que ce soit plus petit, sinon ses chaînes sont rangées
+// telles quelles à la suite, avec la position de chacune
+#define COLUMNS_MAGIC "CSVJCOL2"
+#define COLUMNS_SUFFIX ".cols"
+
+enum { COLUMN_INT = 1, COLUMN_DICT = 2, COLUMN_RAW = 3 };
+
+typedef struct {
+    char mMagic[8];
+    uint64_t mFileSize;
+    uint64_t mSourceSize;       // taille et date du CSV, pour détecter un cache périmé
+    int64_t mSourceMtime;
+    int64_t mSourceMtimeNsec;
+    uint64_t mRowCount;         // lignes de données, sans l'en-tête
+    uint64_t mColumnCount;
+    uint64_t mColumnsOffset;    // ColumnHeader[mColumnCount]
+    uint64_t mHeaderRowOffset;  // en-tête du CSV, terminée par '\0'
+} ColumnsHeader;
+
+typedef struct {
+    uint32_t mType;             // COLUMN_INT, COLUMN_DICT ou COLUMN_RAW
+    uint32_t mWidth;            // octets d'un entier (COLUMN_INT) ou d'une position (COLUMN_RAW)
+    uint64_t mValuesOffset;     // entiers[mRowCount], codes uint32_t[mRowCount] (COLUMN_DICT)
+                                // ou positions[mRowCount + 1] (COLUMN_RAW) : début de chaque chaîne
+    uint64_t mDictCount;
+    uint64_t mDictOffsetsOffset;// uint64_t[mDictCount + 1] : début de chaque chaîne du dictionnaire
+    uint64_t mBytesOffset;      // octets des chaînes (du dictionnaire ou de la colonne)
+} ColumnHeader;
+
+// cache colonnes projeté en mémoire
+typedef struct {
+    const char* mBase;
+    size_t mSize;
+    const ColumnsHeader* mHeader;
+    const ColumnHeader* mColumns;
+} MappedColumns;
+
+// une colonne de cache en construction : des entiers tant que toutes les valeurs
+// sont des entiers canoniques, des codes du dictionnaire ensuite
+typedef struct {
+    int64_t* mValues;
+    uint32_t* mCodes;
+    Dictionary mDict;
+} ColumnBuilder;
+
+// format d'une entrée, reconnu à ses premiers octets
+typedef enum { INPUT_PLAIN, INPUT_GZIP, INPUT_BGZF } InputFormat;
+
+// un membre d'un lot bgzip : ses données deflate et sa place dans le bloc décompressé
+typedef struct {
+    const unsigned char* mData;
+    size_t mSize;
+    char* mOut;
+    size_t mLen;
+    uint32_t mCrc;
+} BgzfMember;
+
+// lecture d'un fichier par blocs, décompressés s'il le faut : un thread remplit un
+// bloc pendant que le join découpe les lignes de l'autre (sans thread, les blocs sont
+// remplis à la demande)
+typedef struct {
+    int mFd;
+    int mThreaded;
+    char* mBlocks[2];
+    size_t mBlockSize;
+    size_t mLength[2];
+    int mReady[2];              // bloc rempli, pas encore consommé
+    int mNext;                  // bloc à remplir ensuite
+    int mCurrent;               // bloc que le join consomme
+    int mHolding;               // le join a commencé à consommer mCurrent
+    size_t mPos;                // position dans mCurrent
+    int mEnd;                   // le dernier bloc est rempli
+    int mFailed;                // erreur de lecture, de décompression ou ligne trop longue :
+                                // plus aucun bloc n'est rendu (cf. close_reader)
+    int mStop;
+
+    InputFormat mFormat;
+    unsigned char mPrefix[BGZF_HEADER_SIZE];    // premiers octets, lus pour le format
+    size_t mPrefixLen;
+    size_t mPrefixPos;
+    unsigned char* mRaw;        // données compressées pas encore décompressées
+    size_t mRawSize;
+    size_t mRawLen;
+    size_t mRawPos;
+    int mRawEnd;                // tout le fichier compressé a été lu
+    z_stream mStream;           // gzip : décompression en continu
+    int mMemberDone;            //   fin d'un membre, un autre peut suivre
+    BgzfMember* mMembers;       // bgzip : membres du lot en cours
+    size_t mMemberCount;
+    size_t mMemberCapacity;
+    size_t mNextMember;         //   prochain membre à décompresser
+    int mBadMember;
+    size_t mWorkers;            //   threads qui décompressent avec celui de lecture
+#ifndef CSV_JOIN_NO_PROFILE
+    uint64_t mWaitTicks;        // temps passé dans wait_block
+#endif
+#ifndef CSV_JOIN_NO_THREADS
+    pthread_t mThread;
+    pthread_mutex_t mLock;
+    pthread_cond_t mChanged;
+    pthread_mutex_t mMemberLock;
+#endif
+} ReadAhead;
 
-// Bucket
-typedef struct Bucket{
-    const char* mKey;
-    const void* mValue;
-    struct Bucket* mNext;    
-} Bucket;
+// écriture différée : le join écrit dans un tube, un thread le vide dans le fichier
+typedef struct {
+    int mFd;
+    int mPipe[2];
+    char* mBlock;
+    size_t mBlockSize;
+    int mError;
+#ifndef CSV_JOIN_NO_THREADS
+    pthread_t mThread;
+#endif
+} WriteBehind;
+
+// lecture des lignes d'une relation, depuis le CSV ou depuis son cache colonnes
+typedef struct {
+    FILE* mFile;
+    ReadAhead* mAhead;          // NULL : lecture du CSV par stdio
+    MappedColumns mColumns;     // mBase != NULL : on lit le cache
+    size_t mRow;                // prochaine ligne du cache, 0 pour l'en-tête
+    int mSeekable;              // 0 si on ne peut lire la relation qu'une fois
+    size_t mSpillLevel;         // 0 pour une relation, n pour une partition de niveau n
+    size_t* mFieldStart;        // position et longueur des champs de la dernière
+    size_t* mFieldLen;          //   ligne reconstruite depuis le cache
+    int mFailed;                // cache incohérent : les lignes lues sont incomplètes
+#ifndef CSV_JOIN_NO_PROFILE
+    uint64_t mTicks;            // temps passé dans reader_row
+#endif
+} RowReader;
+
+// key d'une ligne lue par next_probe_row : le texte du champ, ou l'entier d'une colonne
+// d'entiers du cache, que l'encodage des keys prend tel quel sans relire de texte
+typedef struct {
+    const char* mText;          // NULL si la ligne n'a pas ce champ (ou si mIsInt)
+    size_t mLen;
+    int mIsInt;
+    int64_t mValue;
+    char mDigits[24];           // texte de mValue, écrit à la demande (cf. probe_field_text)
+} ProbeField;
+
+// phases chronométrées d'un join ; les lectures comprennent l'attente des blocs
+// (PHASE_IO_WAIT), qui est donc comptée deux fois
+typedef enum {
+    PHASE_READ_R1,      // reader_row sur R1 (et ses partitions)
+    PHASE_READ_R2,      // reader_row sur R2 (et ses partitions)
+    PHASE_IO_WAIT,      // attente ou lecture des blocs du fichier (ReadAhead)
+    PHASE_HASH,         // encodage des keys de R2
+    PHASE_BUILD,        // ajout des lignes de R1 dans la table
+    PHASE_PROBE,        // recherche des keys de R2 dans la table
+    PHASE_WRITE,        // écriture du résultat (et les étapes du pipeline)
+    PHASE_SPILL,        // écriture des partitions sur disque
+    PHASE_COUNT
+} Phase;
+
+// chronomètres d'un join, en ticks de profile_ticks (cycles quand le processeur a un
+// compteur lisible, nanosecondes sinon) ; les ticks sont convertis en secondes par
+// la durée totale mesurée aussi par l'horloge monotone
+typedef struct {
+    uint64_t mTicks[PHASE_COUNT];
+    uint64_t mStartTicks;
+    uint64_t mStopTicks;
+    uint64_t mStartNanoseconds;
+    uint64_t mStopNanoseconds;
+    ProbeCounts mProbes;        // sondes des tables de R1 (lots, partitions, keys fréquentes)
+} Profile;
 
-// Hash table
+#ifndef CSV_JOIN_NO_PROFILE
+#define PROFILE_TICKS() profile_ticks()
+#define PROFILE_ADD(counter, start) ((counter) += profile_ticks() - (start))
+#define PROFILE_LAP(stats, phase, start) profile_lap(&(stats)->mProfile, (phase), &(start))
+#else
+#define PROFILE_TICKS() 0
+#define PROFILE_ADD(counter, start) ((void) (start))
+#define PROFILE_LAP(stats, phase, start) ((void) (start))
+#endif
+
+// statistiques du plan choisi par hash_join
+typedef struct {
+    size_t mBudget;     // budget mémoire demandé
+    size_t mBatches;    // nombre de lots (= nombre de scans de R2)
+    size_t mRowsR1;
+    size_t mRowsR2;     // lignes de R2 lues, tous scans confondus
+    size_t mRowsOut;
+    size_t mMinBuckets; // taille de table la plus petite/grande utilisée
+    size_t mMaxBuckets;
+    size_t mPeakBytes;  // pic de mémoire comptée (table + tampons)
+    size_t mBadKeys;    // lignes de R1 ignorées : key absente ou pas un entier
+    KeyType mKeyType;   // type de key finalement utilisé
+    size_t mDictPeak;   // plus grand nombre de chaînes dans le dictionnaire
+    size_t mPartitions; // partitions écrites sur disque (R2 non relisible), 0 sinon
+    size_t mHeavyKeys;  // keys très fréquentes de R2 jointes en mémoire pendant la répartition
+    size_t mHeavyRows;  // lignes de R2 de ces keys, qui ne sont pas allées dans une partition
+    size_t mMatches;    // lignes de R2 dont la key est dans R1
+    size_t mAllocated;  // octets mis dans les tables de R1, tous lots confondus
+#ifndef CSV_JOIN_NO_PROFILE
+    Profile mProfile;
+#endif
+} JoinStats;
+
+// keys très fréquentes d'un échantillon de R2 : un count-min sketch estime la fréquence
+// de chaque key, et les HEAVY_MAX_KEYS plus grandes estimations sont gardées ; une fois
+// choisies, leurs lignes de R1 sont chargées dans mTable et leurs lignes de R2 y sont
+// jointes directement, sans surcharger la partition de leur key
 typedef struct {
-    unsigned int mSize;
-    Bucket** mListOfBucket;
-} Htable;
+    uint32_t* mCounts;              // SKETCH_DEPTH lignes de mWidth compteurs
+    size_t mWidth;                  // puissance de 2
+    char* mKeys[HEAVY_MAX_KEYS];    // texte des keys candidates (copies)
+    size_t mLens[HEAVY_MAX_KEYS];
+    size_t mEstimates[HEAVY_MAX_KEYS];
+    size_t mCount;
+    key_word mHot[HEAVY_MAX_KEYS];  // keys retenues, encodées par mCodec
+    size_t mHotCount;
+    Htable* mTable;                 // leurs lignes de R1
+    KeyCodec mCodec;
+} HeavyHitters;
 
 
 typedef char* csv_row;
 typedef const char* csv_const_row;
 
+// un champ d'un tuple intermédiaire : un morceau d'une ligne, sans copie
+typedef struct {
+    const char* mStart;
+    size_t mLen;
+} TupleField;
+
+typedef struct {
+    TupleField* mFields;
+    size_t mCount;
+    size_t mCapacity;
+} Tuple;
+
+// une étape de join supplémentaire : une relation de dimension chargée en mémoire,
+// jointe au tuple qui sort de l'étape précédente
+typedef struct {
+    char* mSource;
+    size_t mColumn;         // colonne de join dans la dimension
+    size_t mTupleColumn;    // colonne de join dans le tuple (comme dans le CSV intermédiaire)
+    Htable* mTable;
+    KeyCodec mCodec;
+    csv_row mHeader;
+    size_t mHits;           // tuples qui ont traversé cette étape
+} JoinStage;
+
+// pipeline de joins : les tuples passent d'une étape à l'autre en mémoire, sous forme
+// de champs pointant dans les lignes, et ne sont écrits qu'à la fin
+typedef struct {
+    JoinStage* mStages;
+    size_t mCount;
+    Tuple* mTuples;         // mCount + 1 tuples : celui qui entre dans chaque étape, puis le résultat
+} Pipeline;
+
+// ce que le join écrit pour chaque ligne de R2
+typedef enum {
+    JOIN_INNER = 0,     // les lignes jointes
+    JOIN_SEMI,          // la ligne de R2 si sa key est dans R1 (une fois)
+    JOIN_ANTI,          // la ligne de R2 si sa key n'est pas dans R1
+    JOIN_GROUP          // rien : les agrégats de R2 sont écrits avec chaque ligne de R1
+} JoinMode;
+
+// un agrégat d'une colonne de R2, calculé pour chaque key de R1 (group-join)
+#define MAX_AGGREGATES 16
+typedef enum { AGG_COUNT, AGG_SUM, AGG_MIN, AGG_MAX } AggregateKind;
+
+typedef struct {
+    AggregateKind mKind;
+    size_t mColumn;         // colonne de R2 (sauf AGG_COUNT)
+} Aggregate;
+
+// accumulateur d'un agrégat, rangé dans la copie de la ligne de R1, après son '\0'
+// (cf. attach_accumulators) : la table le met à jour sur place
+typedef struct {
+    int64_t mInt;           // somme ou extremum tant que ce sont des entiers
+    double mReal;           // la même valeur en réel, toujours à jour
+    size_t mCount;          // valeurs numériques vues (lignes jointes pour AGG_COUNT)
+    int mIsReal;            // la valeur n'est pas (ou plus) un entier
+} Accumulator;
+
+// lignes de R2 déjà retenues par un lot précédent, quand un semi-join ou un anti-join
+// demande plusieurs lots : un bit par ligne, dans l'ordre du scan
+typedef struct {
+    unsigned char* mBits;
+    size_t mBytes;
+    int mFailed;            // on n'a pas pu agrandir mBits
+} ProbeMarks;
+
+// options de hash_join
+typedef struct {
+    KeyType mKeyType;       // type déclaré des keys, KEY_AUTO pour le déduire
+    Pipeline* mPipeline;    // étapes de join après R1 x R2, NULL si aucune
+    size_t mOutputBuffer;   // mémoire des tampons de sortie (stdio, thread d'écriture)
+    JoinMode mMode;
+    Aggregate mAggregates[MAX_AGGREGATES];  // agrégats de JOIN_GROUP
+    size_t mAggregateCount;
+    const char* mStatsPath; // fichier des statistiques en JSON, NULL si aucun
+} JoinOptions;
+
 //Prototypes
 
-Htable* construct_Htable(size_t size);
-void delete_Htable_and_content(Htable*);
-void delete_Bucket(Bucket*);
-int add_Htable_value(Htable*, const char*,const void*);
-int add_Bucket(Htable*, const char*, const void*);
-const void* get_Htable_value(Htable*, const char*);
-Bucket* get_Htable_bucket(Htable*, const char*);
+Htable* construct_row_Htable(size_t);
+size_t row_bytes(const void*);
+
+int parse_int_key(const char*, size_t, int, int64_t*);
+void init_Dictionary(Dictionary*);
+void clear_Dictionary(Dictionary*);
+int find_Dictionary(const Dictionary*, const char*, size_t, uint32_t*);
+int intern_Dictionary(Dictionary*, const char*, size_t, uint32_t*);
+size_t dictionary_slot(const Dictionary*, const char*, size_t);
+key_word inline_key(const char*, size_t);
+void init_KeyCodec(KeyCodec*, KeyType);
+int encode_build_key(KeyCodec*, const char*, size_t, key_word*);
+int encode_probe_key(const KeyCodec*, const char*, size_t, key_word*);
+int encode_probe_field(const KeyCodec*, ProbeField*, key_word*);
+size_t key_footprint(const KeyCodec*, const char*, size_t);
+int rekey_Htable(Htable*, KeyCodec*, size_t);
+
+const char* row_field(const csv_const_row, size_t, size_t*);
+size_t entry_footprint(const char*);
+size_t row_footprint(Htable*, const KeyCodec*, csv_const_row, const char*, size_t, Bucket**);
+size_t buckets_for_budget(size_t, size_t);
+int add_row_to_hashtable(Htable*, KeyCodec*, csv_row, const char*, size_t, size_t, int, Bucket* const*);
+int hash_join(RowReader*, RowReader*, FILE*, size_t, size_t, size_t, const JoinOptions*);
+int build_and_probe(RowReader*, RowReader*, FILE*, csv_const_row, csv_const_row, size_t, size_t, size_t,
+                    const JoinOptions*, JoinStats*);
+size_t join(Htable*, const KeyCodec*, RowReader*, FILE*, size_t, const JoinOptions*, ProbeMarks*, int, int,
+            JoinStats*);
+size_t partition_of(KeyType, const char*, size_t, size_t, size_t);
+size_t choose_partitions(const RowReader*, const Htable*, size_t, size_t);
+int spill_row(FILE**, size_t, size_t, KeyType, csv_const_row, const char*, size_t);
+int detach_spill(FILE*);
+FILE* reopen_spill(int, char*, size_t);
+int partition_join(Htable*, KeyCodec*, csv_row, RowReader*, RowReader*, FILE*, csv_const_row, csv_const_row,
+                   size_t, size_t, size_t, const JoinOptions*, JoinStats*);
+int init_HeavyHitters(HeavyHitters*, size_t);
+void clear_HeavyHitters(HeavyHitters*);
+int same_key(KeyType, const char*, size_t, const char*, size_t);
+void sketch_row(HeavyHitters*, KeyType, const char*, size_t);
+int choose_heavy_keys(HeavyHitters*, KeyType, size_t);
+int split_heavy_rows(HeavyHitters*, FILE**, char**, size_t, size_t, KeyType, size_t, csv_const_row, size_t, size_t,
+                     size_t);
+int is_heavy_key(const HeavyHitters*, const char*, size_t, key_word*);
+void print_join_stats(FILE*, const JoinStats*);
+
+void init_JoinStats(JoinStats*, size_t);
+void stop_JoinStats(JoinStats*, const RowReader*, const RowReader*);
+uint64_t profile_ticks(void);
+uint64_t profile_nanoseconds(void);
+void profile_lap(Profile*, Phase, uint64_t*);
+void add_probe_counts(JoinStats*, const Htable*);
+double profile_seconds(const Profile*, uint64_t);
+void print_profile(FILE*, const JoinStats*);
+void write_join_json(FILE*, const JoinStats*);
+int dump_join_stats(const char*, const JoinStats*);
 
-int add_row_to_hashtable(Htable*, csv_row, size_t);
-int hash_join(FILE*, FILE*, FILE*, size_t, size_t, size_t);
-void join(Htable*, FILE*, FILE*, size_t);
+size_t accumulators_offset(csv_const_row);
+size_t accumulators_footprint(csv_const_row, size_t);
+csv_row attach_accumulators(csv_row, size_t);
+Accumulator* row_accumulators(csv_const_row);
+int parse_number(const char*, size_t, int64_t*, double*);
+void accumulate(Accumulator*, const JoinOptions*, csv_const_row);
+void write_aggregates(FILE*, const JoinOptions*, const Accumulator*);
+size_t emit_groups(Htable*, FILE*, const JoinOptions*);
+size_t marks_reserve(RowReader*, int*);
+size_t count_reader_rows(RowReader*);
+int reserve_marks(ProbeMarks*, size_t);
+int mark_row(ProbeMarks*, size_t);
+int is_marked(const ProbeMarks*, size_t);
+size_t filter_row(FILE*, JoinMode, int, csv_const_row, ProbeMarks*, size_t, int);
+size_t probe_row(FILE*, const JoinOptions*, const Bucket*, csv_const_row, size_t, ProbeMarks*, size_t, int);
+void emit_header(FILE*, const JoinOptions*, csv_const_row, csv_const_row, size_t);
+int parse_aggregate(const char*, Aggregate*);
+
+Htable* load_Htable(RowReader*, size_t, KeyCodec*, size_t, size_t*);
+int write_padding(FILE*, size_t);
+int build_index(RowReader*, const char*, size_t, KeyType, const char*);
+int check_index_section(const IndexHeader*, uint64_t, uint64_t, size_t);
+int open_index(MappedIndex*, const char*, const char*, size_t, KeyType);
+void close_index(MappedIndex*);
+int encode_index_key(const MappedIndex*, const char*, size_t, key_word*);
+const char* get_index_value(const MappedIndex*, key_word, size_t*);
+int index_join(const MappedIndex*, RowReader*, FILE*, size_t, const JoinOptions*);
+
+void sidecar_path(const char*, char[]);
+int column_to_strings(ColumnBuilder*, size_t, size_t);
+uint32_t int_width(int64_t, int64_t);
+void write_word(FILE*, uint64_t, uint32_t);
+int write_sidecar(const char*, size_t);
+size_t sidecar_footprint(const ColumnBuilder*, size_t, size_t);
+int check_column_section(const ColumnsHeader*, uint64_t, uint64_t, size_t);
+int check_column(const char*, const ColumnsHeader*, const ColumnHeader*);
+int map_sidecar(MappedColumns*, const char*);
+void open_reader(RowReader*, FILE*, const char*, size_t, int);
+size_t reader_footprint(const RowReader*);
+csv_row reader_row(RowReader*);
+csv_row columns_row(RowReader*);
+csv_row columns_current_row(RowReader*);
+int64_t column_int(const MappedColumns*, const ColumnHeader*, size_t);
+size_t format_int(int64_t, char[]);
+const char* column_text(const MappedColumns*, const ColumnHeader*, size_t, size_t*);
+int next_probe_row(RowReader*, size_t, csv_row*, ProbeField*);
+const char* probe_field_text(ProbeField*, size_t*);
+const char* reader_field(const RowReader*, csv_const_row, size_t, size_t*);
+int rewind_reader(RowReader*);
+int close_reader(RowReader*);
+int push_field(Tuple*, const char*, size_t);
+int split_row(Tuple*, csv_const_row, size_t);
+size_t row_width(csv_const_row, size_t);
+void write_tuple(FILE*, const Tuple*);
+int add_stage(Pipeline*, const char*);
+int load_stage(JoinStage*, KeyType, size_t, int);
+int check_pipeline(const Pipeline*, csv_const_row, csv_const_row, size_t);
+size_t pipeline_bytes(const Pipeline*);
+size_t emit_rows(FILE*, Pipeline*, csv_const_row, csv_const_row, size_t, int);
+size_t emit_stage(FILE*, Pipeline*, size_t, int);
+void print_pipeline_stats(FILE*, const Pipeline*);
+void delete_Pipeline(Pipeline*);
+size_t io_block_for_budget(size_t);
+ssize_t read_raw(ReadAhead*, void*, size_t);
+int open_input(ReadAhead*);
+void close_input(ReadAhead*);
+int fill_block(ReadAhead*, char*, size_t*);
+int start_read_ahead(ReadAhead*, int, size_t, int);
+void stop_read_ahead(ReadAhead*);
+int restart_read_ahead(ReadAhead*);
+void delete_read_ahead(ReadAhead*);
+int wait_block(ReadAhead*);
+void fail_read_ahead(ReadAhead*);
+void release_block(ReadAhead*);
+csv_row read_ahead_row(ReadAhead*);
+FILE* start_write_behind(WriteBehind*, FILE*, size_t);
+int finish_write_behind(WriteBehind*, FILE*);
+int is_bgzf_header(const unsigned char*);
+InputFormat detect_format(const unsigned char*, size_t, size_t);
+uint32_t read_le32(const unsigned char*);
+int fill_gzip(ReadAhead*, char*, size_t*);
+void* inflate_members(void*);
+int fill_bgzf(ReadAhead*, char*, size_t*);
+void usage(const char*);
+int parse_size_t(const char*, size_t*);
 
  
 
@@ -101,144 +627,294 @@ size_t ask_size_t(const char* question)
  * ======================================================================
  */
 
-/** ----------------------------------------------------------------------
- ** Hash a string for a given hashtable size.
- ** See http://en.wikipedia.org/wiki/Jenkins_hash_function
- **/
-size_t hash_function(const char* key, size_t size)
-{
-    size_t hash = 0;
-    size_t key_len = strlen(key);
-    for (size_t i = 0; i < key_len; ++i) {
-        hash += (unsigned char) key[i];
-        hash += (hash << 10);
-        hash ^= (hash >> 6);
+const HtableOps ROW_TABLE_OPS = { NULL, NULL, row_bytes, free, NULL };
+
+// fonction pour construire une table des lignes de R1 : keys encodées (cf. Part I bis),
+// lignes copiées par read_row, comptées dans mBytes et libérées avec la table
+// return NULL si on n'arrive pas à allouer
+
+Htable* construct_row_Htable(size_t size){
+    return construct_Htable(size, &ROW_TABLE_OPS);
+}
+
+// fonction qui retourne les octets alloués pour la copie d'une ligne
+
+size_t row_bytes(const void* row){
+    return ALLOC_SIZE(strlen((const char*) row) + 1);
+}
+
+/* ======================================================================
+ * Part I bis -- Typed and dictionary-encoded keys
+ * ======================================================================
+ */
+
+// fonction pour lire un entier 64 bits dans [s, s + len)
+// si canonical, on refuse les écritures non canoniques ("+1", "007", "-0", "") :
+// deux entiers canoniques sont égaux si et seulement si leurs chaînes le sont
+// return 0 si réussit
+
+int parse_int_key(const char* s, size_t len, int canonical, int64_t* value){
+    size_t i = 0;
+    int negative = 0;
+    if (i < len && (s[i] == '-' || (!canonical && s[i] == '+'))){
+        negative = (s[i] == '-');
+        i++;
     }
-    hash += (hash << 3);
-    hash ^= (hash >> 11);
-    hash += (hash << 15);
+    if (i == len)
+        return -1;
+    if (canonical && s[i] == '0' && (len - i > 1 || negative))
+        return -1;
 
-    return hash % size;
+    uint64_t limit = negative ? (uint64_t) INT64_MAX + 1 : (uint64_t) INT64_MAX;
+    uint64_t v = 0;
+    for (; i < len; i++){
+        if (s[i] < '0' || s[i] > '9')
+            return -1;
+        unsigned digit = s[i] - '0';
+        if (v > (limit - digit) / 10)   // dépassement
+            return -1;
+        v = v * 10 + digit;
+    }
+    *value = negative ? (int64_t) (0 - v) : (int64_t) v;
+    return 0;
 }
 
-/* ****************************************
- * TODO : add your own code here.
- * **************************************** */
+// fonction pour initialiser un dictionnaire vide
 
-// fonction pour construire un hash table avec sa taille
-// return NULL si on n'arrive pas à allouer 
+void init_Dictionary(Dictionary* dict){
+    dict->mStrings = NULL;
+    dict->mCount = 0;
+    dict->mCapacity = 0;
+    dict->mSlots = NULL;
+    dict->mSlotCount = 0;
+    dict->mBytes = 0;
+}
 
-Htable* construct_Htable(size_t size){
-    if (size < 1)
-        return NULL;
+// fonction pour vider un dictionnaire et libérer toute sa mémoire
 
-    Htable* table = malloc( sizeof(Htable));
+void clear_Dictionary(Dictionary* dict){
+    size_t i;
+    for (i = 0; i < dict->mCount; i++)
+        free(dict->mStrings[i]);
+    free(dict->mStrings);
+    free(dict->mSlots);
+    init_Dictionary(dict);
+}
 
-    if (table != NULL) {
-        table->mListOfBucket = calloc(size, sizeof(Bucket*));
-        if (table->mListOfBucket == NULL){
-            free(table);
-            table =  NULL;
-        } else {
-            int i;
-            for(i = 0; i < size; i++){
-                table->mListOfBucket[i] = NULL ;
-            }
-            table->mSize = size;
+// fonction qui cherche la case de la chaîne [s, s + len) dans la table d'adressage ouvert
+// return l'indice de la case qui la contient, ou de la case vide où l'insérer
+
+size_t dictionary_slot(const Dictionary* dict, const char* s, size_t len){
+    size_t mask = dict->mSlotCount - 1;
+    size_t i = hash_bytes(s, len) & mask;
+    while (dict->mSlots[i] != 0){
+        const char* other = dict->mStrings[dict->mSlots[i] - 1];
+        if (0 == strncmp(other, s, len) && other[len] == '\0')
+            return i;
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+// fonction pour trouver le code d'une chaîne
+// return 0 si la chaîne est dans le dictionnaire
+
+int find_Dictionary(const Dictionary* dict, const char* s, size_t len, uint32_t* code){
+    if (dict->mCount == 0)
+        return -1;
+    size_t i = dictionary_slot(dict, s, len);
+    if (dict->mSlots[i] == 0)
+        return -1;
+    *code = dict->mSlots[i] - 1;
+    return 0;
+}
+
+// fonction pour ajouter une chaîne au dictionnaire (si elle n'y est pas déjà)
+// return 0 si réussit, -1 si on ne peut pas allouer
+
+int intern_Dictionary(Dictionary* dict, const char* s, size_t len, uint32_t* code){
+    if (0 == find_Dictionary(dict, s, len, code))
+        return 0;
+    if (dict->mCount >= UINT32_MAX - 1)
+        return -1;
+
+    if (dict->mCount == dict->mCapacity){
+        size_t capacity = dict->mCapacity == 0 ? 16 : 2 * dict->mCapacity;
+        char** strings = realloc(dict->mStrings, capacity * sizeof(char*));
+        if (strings == NULL)
+            return -1;
+        dict->mBytes += ALLOC_SIZE(capacity * sizeof(char*)) - ALLOC_SIZE(dict->mCapacity * sizeof(char*));
+        dict->mStrings = strings;
+        dict->mCapacity = capacity;
+    }
+    // table d'adressage ouvert remplie à moitié au plus
+    if (2 * (dict->mCount + 1) > dict->mSlotCount){
+        size_t count = dict->mSlotCount == 0 ? 32 : 2 * dict->mSlotCount;
+        uint32_t* slots = calloc(count, sizeof(uint32_t));
+        if (slots == NULL)
+            return -1;
+        dict->mBytes += ALLOC_SIZE(count * sizeof(uint32_t)) - ALLOC_SIZE(dict->mSlotCount * sizeof(uint32_t));
+        free(dict->mSlots);
+        dict->mSlots = slots;
+        dict->mSlotCount = count;
+        size_t i;
+        for (i = 0; i < dict->mCount; i++){
+            const char* other = dict->mStrings[i];
+            dict->mSlots[dictionary_slot(dict, other, strlen(other))] = i + 1;
         }
     }
-    return table;
+
+    char* copy = malloc(len + 1);
+    if (copy == NULL)
+        return -1;
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    dict->mBytes += ALLOC_SIZE(len + 1);
+
+    size_t slot = dictionary_slot(dict, s, len);
+    dict->mStrings[dict->mCount] = copy;
+    dict->mSlots[slot] = dict->mCount + 1;
+    *code = dict->mCount++;
+    return 0;
 }
 
-// fonction pour détruire un hash table
+// fonction pour initialiser l'encodage des keys avec le type déclaré
 
-void delete_Htable_and_content(Htable* table){
-    size_t size = table->mSize;
-    int i;
-    for(i = 0; i < size; i++)
-        delete_Bucket(table->mListOfBucket[i]);
+void init_KeyCodec(KeyCodec* codec, KeyType type){
+    codec->mType = type;
+    codec->mAuto = (type == KEY_AUTO);
+    init_Dictionary(&codec->mDict);
+}
 
-    free(table->mListOfBucket);
-    table->mListOfBucket = NULL;
+// fonction qui range une chaîne courte dans un mot (octets + longueur + 1 en poids fort)
 
-    free(table);
-    table = NULL;
+key_word inline_key(const char* s, size_t len){
+    key_word key = (key_word) (len + 1) << 56;
+    size_t i;
+    for (i = 0; i < len; i++)
+        key |= (key_word) (unsigned char) s[i] << (8 * i);
+    return key;
 }
 
-// fonction pour détruire un bucket
+// fonction pour encoder une key de R1 ; les chaînes longues entrent dans le dictionnaire
+// return 0 si réussit, 1 si la key n'est pas un entier (KEY_INT déclaré),
+//        2 si la key n'est pas un entier alors que le type déduit était KEY_INT,
+//        -1 si on ne peut pas allouer
 
-void delete_Bucket(Bucket* bucket){
-    if (bucket == NULL)
-        return;
-    else{
-        Bucket* curr;
-        while((curr = bucket) != NULL){
-            bucket = bucket->mNext;
-            free((void*)curr->mValue);  //cash void* pour éviter le warning
-            free((void*)curr->mKey);
-            free(curr);
-            curr = NULL;
+int encode_build_key(KeyCodec* codec, const char* s, size_t len, key_word* key){
+    int64_t value;
+    if (codec->mType == KEY_AUTO)
+        codec->mType = (0 == parse_int_key(s, len, 1, &value)) ? KEY_INT : KEY_STRING;
+
+    if (codec->mType == KEY_INT){
+        if (0 == parse_int_key(s, len, codec->mAuto, &value)){
+            *key = (key_word) value;
+            return 0;
         }
+        return codec->mAuto ? 2 : 1;
+    }
+
+    if (len <= KEY_INLINE_MAX){
+        *key = inline_key(s, len);
+        return 0;
     }
+    uint32_t code;
+    if (0 != intern_Dictionary(&codec->mDict, s, len, &code))
+        return -1;
+    *key = code;
+    return 0;
 }
 
-// fonction pour ajouter un key et une valeur dans le hash table
-// return 0 si réussit
+// fonction pour encoder une key de R2, sans rien ajouter au dictionnaire
+// return 0 si réussit, 1 si la key ne peut correspondre à aucune key de R1
 
-int add_Htable_value(Htable* table, const char* key,const void* value){
-    int success;
-    Bucket* bucket = get_Htable_bucket(table, key);
-    if ( bucket == NULL) {                      //ne pas trouver => ajoute nouveau bucket
-        success = add_Bucket(table,key,value);
-    } else {                                    //trouver => mettre à jour sa valeur
-        bucket->mValue = value;
-        success = 0 ;
+int encode_probe_key(const KeyCodec* codec, const char* s, size_t len, key_word* key){
+    int64_t value;
+    if (codec->mType == KEY_INT){
+        if (0 != parse_int_key(s, len, codec->mAuto, &value))
+            return 1;
+        *key = (key_word) value;
+        return 0;
     }
-    return success;
+    if (len <= KEY_INLINE_MAX){
+        *key = inline_key(s, len);
+        return 0;
+    }
+    uint32_t code;
+    if (codec->mType == KEY_AUTO || 0 != find_Dictionary(&codec->mDict, s, len, &code))
+        return 1;
+    *key = code;
+    return 0;
 }
 
-// fonction pour ajouter un nouveau bucket 
-// return 0 si réussit
-
-int add_Bucket(Htable* table, const char* key, const void* value){
-    Bucket* head = malloc( sizeof(Bucket));
+// fonction pour encoder la key d'une ligne de R2 lue par next_probe_row : l'entier
+// d'une colonne du cache est déjà la key d'un join sur des entiers
+// return comme encode_probe_key
 
-    if (head == NULL)
-        return -1;
-    else {
-        size_t index = hash_function(key, table->mSize);
-        head->mKey = key;
-        head->mValue = value;
-        head->mNext = table->mListOfBucket[index];
-        table->mListOfBucket[index] = head ;
+int encode_probe_field(const KeyCodec* codec, ProbeField* field, key_word* key){
+    size_t len = 0;
+    if (field->mIsInt && codec->mType == KEY_INT){
+        *key = (key_word) field->mValue;
         return 0;
     }
+    const char* text = probe_field_text(field, &len);
+    return text != NULL ? encode_probe_key(codec, text, len, key) : 1;
 }
 
-// fonction pour récupérer la valeur à partir d'un key
-// return NULL si le key n'existe pas
+// fonction qui retourne les octets que l'encodage d'une key de R1 peut allouer
 
-const void* get_Htable_value(Htable* table, const char* key){
-    Bucket* bucket = get_Htable_bucket(table, key);
-    if (bucket == NULL)
-        return NULL;
-    else
-        return bucket->mValue; 
+size_t key_footprint(const KeyCodec* codec, const char* s, size_t len){
+    uint32_t code;
+    if (codec->mType == KEY_INT || len <= KEY_INLINE_MAX
+        || 0 == find_Dictionary(&codec->mDict, s, len, &code))
+        return 0;
+
+    // la copie de la chaîne, plus les tableaux du dictionnaire s'ils doivent doubler
+    const Dictionary* dict = &codec->mDict;
+    size_t cost = ALLOC_SIZE(len + 1);
+    if (dict->mCount == dict->mCapacity)
+        cost += ALLOC_SIZE((dict->mCapacity == 0 ? 16 : 2 * dict->mCapacity) * sizeof(char*));
+    if (2 * (dict->mCount + 1) > dict->mSlotCount)
+        cost += ALLOC_SIZE((dict->mSlotCount == 0 ? 32 : 2 * dict->mSlotCount) * sizeof(uint32_t));
+    return cost;
 }
 
-//fonction pour récupérer le bucket à partir d'un key
-// return NULL si le key n'existe pas
+// fonction pour ré-encoder toutes les keys de la table en chaînes, quand une key
+// de R1 contredit le type KEY_INT déduit des premières lignes
+// return 0 si réussit
 
-Bucket* get_Htable_bucket(Htable* table, const char*  key){
-    Bucket* bucket, *next;
-    size_t index = hash_function(key, table->mSize);
-    bucket = table->mListOfBucket[index];
-    for (; bucket != NULL; bucket = next){
-        if (0 == strcmp(key, bucket->mKey))
-            return bucket ;
-        next = bucket->mNext;
+int rekey_Htable(Htable* table, KeyCodec* codec, size_t col){
+    Bucket* list = NULL;
+    size_t i;
+    finish_rehash_Htable(table);
+    for (i = 0; i < table->mSize; i++){       // détacher tous les buckets
+        Bucket* bucket = table->mListOfBucket[i];
+        while (bucket != NULL){
+            Bucket* next = bucket->mNext;
+            bucket->mNext = list;
+            list = bucket;
+            bucket = next;
+        }
+        table->mListOfBucket[i] = NULL;
     }
-    return NULL;
+
+    codec->mType = KEY_STRING;
+    codec->mAuto = 0;
+    int success = 0;
+    while (list != NULL){
+        Bucket* bucket = list;
+        list = list->mNext;
+        size_t len = 0;
+        const void* const* rows;
+        bucket_rows(bucket, &rows);     // les lignes d'un bucket ont la même key
+        const char* field = row_field(rows[0], col, &len);
+        if (success == 0 && 0 != encode_build_key(codec, field, len, &bucket->mKey))
+            success = -1;   // on garde le bucket pour pouvoir le libérer
+        size_t index = Htable_index(table, bucket->mKey, table->mSize);
+        bucket->mNext = table->mListOfBucket[index];
+        table->mListOfBucket[index] = bucket;
+    }
+    return success;
 }
 
 /* ======================================================================
@@ -275,15 +951,17 @@ csv_row read_row(FILE* f)
  **/
 void write_row(FILE* out, const csv_const_row row, size_t ignore_index)
 {
-    size_t len = strlen(row);
-    size_t current_element = 0;
-    for (size_t i = 0; i < len; ++i) {
-        if (row[i] == CSV_SEPARATOR) {
-            ++current_element;
-        }
-        if (current_element != ignore_index && (ignore_index != 0 || current_element != ignore_index + 1 || row[i] != CSV_SEPARATOR)) {
-            fprintf(out, "%c", row[i]);
-        }
+    // écrit par morceaux : avec les threads d'entrée/sortie, chaque appel à stdio
+    // prend le verrou du FILE*
+    size_t len = 0;
+    const char* field = ignore_index == (size_t) -1 ? NULL : row_field(row, ignore_index, &len);
+    if (field == NULL) {
+        fputs(row, out);
+    } else if (ignore_index == 0) {
+        fputs(field[len] == CSV_SEPARATOR ? field + len + 1 : field + len, out);
+    } else {
+        fwrite(row, 1, field - 1 - row, out);
+        fputs(field + len, out);
     }
 }
 
@@ -293,9 +971,32 @@ void write_row(FILE* out, const csv_const_row row, size_t ignore_index)
 void write_rows(FILE* out, const csv_const_row row1, const csv_const_row row2, size_t ignore_index)
 {
     write_row(out, row1, (size_t) -1);
-    fprintf(out, "%c", CSV_SEPARATOR);
+    fputc(CSV_SEPARATOR, out);
     write_row(out, row2, ignore_index);
-    fprintf(out, "\n");
+    fputc('\n', out);
+}
+
+/** ----------------------------------------------------------------------
+ ** Locate the i'th element in the row, without copying it
+ ** Returns a pointer into the row and its length in *len, NULL if the
+ ** row has less than index + 1 elements.
+ **/
+const char* row_field(const csv_const_row row, size_t index, size_t* len)
+{
+    const char* start = row;
+    for (size_t i = 0; i < index; ++i) {
+        start = strchr(start, CSV_SEPARATOR);
+        if (start == NULL) {
+            return NULL;
+        }
+        ++start;
+    }
+    size_t elem_len = 0;
+    while (start[elem_len] != '\0' && start[elem_len] != CSV_SEPARATOR) {
+        ++elem_len;
+    }
+    *len = elem_len;
+    return start;
 }
 
 /** ----------------------------------------------------------------------
@@ -303,33 +1004,19 @@ void write_rows(FILE* out, const csv_const_row row1, const csv_const_row row2, s
  **/
 char* row_element(const csv_const_row row, size_t index)
 {
-    size_t len = strlen(row);
-    size_t start = 0, end = 0;
-    size_t current_element = 0;
-    for (size_t i = 0; i < len; ++i) {
-        if (row[i] == CSV_SEPARATOR || i == len - 1) {
-            ++current_element;
-            if (current_element == index) {
-                start = i + 1;
-            } else if (current_element == index + 1) {
-                end = (i == len - 1) ? len : i;
-                break;
-            }
-        }
+    size_t elem_len = 0;
+    const char* start = row_field(row, index, &elem_len);
+    if (start == NULL || *row == '\0') {
+        return NULL;
     }
 
-    if (end > 0) { // success
-        size_t elem_len = end - start;
-        char* element;
-        if ((element = calloc(elem_len + 1, sizeof(char))) == NULL) {
-            return NULL;
-        }
-        element[elem_len] = '\0';
-        strncpy(element, &row[start], elem_len);
-        return element;
-    } else {
+    char* element;
+    if ((element = calloc(elem_len + 1, sizeof(char))) == NULL) {
         return NULL;
     }
+    element[elem_len] = '\0';
+    strncpy(element, start, elem_len);
+    return element;
 }
 
 
@@ -342,110 +1029,3665 @@ char* row_element(const csv_const_row row, size_t index)
  * TODO : add your own code here.
  * **************************************** */
 
+// fonction qui retourne les octets réellement alloués pour une entrée de la table :
+// le bucket et la copie de la ligne (la key est encodée dans le bucket)
+
+size_t entry_footprint(const char* row){
+    return ALLOC_SIZE(sizeof(Bucket)) + row_bytes(row);
+}
+
+// fonction qui retourne les octets qu'ajouter la ligne row de R1 (de key field) va
+// allouer : sa copie et le RowList qui grandit si sa key est déjà dans la table,
+// sinon un nouveau bucket et la key ; *bucket : le bucket de la key, NULL si elle n'est
+// pas dans la table (cf. add_row_to_hashtable, tant que la table ne change pas)
+
+size_t row_footprint(Htable* table, const KeyCodec* codec, csv_const_row row, const char* field, size_t len,
+                     Bucket** bucket){
+    key_word key;
+    const void* const* rows;
+    *bucket = NULL;
+    if (field == NULL)
+        return entry_footprint(row);
+    if (0 == encode_probe_key(codec, field, len, &key) && (*bucket = find_Htable_bucket(table, key)) != NULL)
+        return ALLOC_SIZE(strlen(row) + 1) + row_list_growth(bucket_rows(*bucket, &rows));
+    return entry_footprint(row) + key_footprint(codec, field, len);
+}
+
+// fonction qui choisit le nombre de buckets pour un budget (en octets) et une
+// taille moyenne d'entrée, de sorte que la table soit remplie à HASH_TABLE_LOAD_FACTOR
+// quand le budget est atteint : budget = size * sizeof(Bucket*) + LOAD_FACTOR * size * entry
+
+size_t buckets_for_budget(size_t budget, size_t entry){
+    size_t size = budget / (sizeof(Bucket*) + HASH_TABLE_LOAD_FACTOR * entry);
+    return size < 1 ? 1 : size;
+}
+
 // fonction pour faire le hash-join
+// le budget couvre la table (tableau, buckets, lignes), le dictionnaire des keys et les
+// tampons d'entrée/sortie ; cf. build_and_probe
+// return O si réussit
+
+int hash_join(RowReader* in1, RowReader* in2, FILE* out, size_t col1, size_t col2, size_t size_memory,
+              const JoinOptions* options){
+    JoinStats stats;
+    Pipeline* pipeline = options->mPipeline;
+    init_JoinStats(&stats, size_memory);
+
+    // les tampons des fichiers et les tables des étapes suivantes, déjà chargées,
+    // comptent dans le budget
+    size_t reserved = JOIN_LINE_OVERHEAD + reader_footprint(in1) + reader_footprint(in2)
+                      + options->mOutputBuffer + pipeline_bytes(pipeline);
+    if (size_memory <= reserved){
+        fprintf(stderr, "Budget mémoire trop petit : il faut plus de %zu octets pour les tampons"
+                " et les tables des autres joins\n", reserved);
+        return -1;
+    }
+    size_t budget = size_memory - reserved; // ce qui reste pour la table
+
+    csv_row header1 = reader_row(in1);
+    csv_row header2 = reader_row(in2);
+    if (header1 == NULL || header2 == NULL || 0 != check_pipeline(pipeline, header1, header2, col2)){
+        if (header1 == NULL || header2 == NULL)
+            fprintf(stderr, "On ne peut pas lire les en-têtes\n");
+        free(header1);
+        free(header2);
+        return -1;
+    }
+    emit_header(out, options, header1, header2, col2); // écrire en-tete
+
+    int success = build_and_probe(in1, in2, out, header1, header2, col1, col2, budget, options, &stats);
+    if (success == 0){
+        stats.mPeakBytes += reserved;
+        stop_JoinStats(&stats, in1, in2);
+        print_join_stats(stderr, &stats);
+        if (options->mStatsPath != NULL && 0 != dump_join_stats(options->mStatsPath, &stats))
+            success = -1;
+    }
+    free(header1);
+    free(header2);
+    return success;
+}
+
+// fonction qui fait le join de R1 et R2, dont les en-têtes ont déjà été lus :
+// on remplit la table tant que l'entrée suivante de R1 tient dans le budget, puis on
+// scanne R2. La taille de la table est réajustée entre les lots selon la taille moyenne
+// observée des entrées. Si R2 ne peut pas être relue et que R1 ne tient pas dans le
+// budget, on passe par des partitions sur disque (partition_join).
 // return O si réussit
 
-int hash_join(FILE* in1, FILE* in2, FILE* out, size_t col1, size_t col2, size_t size_memory){
-    size_t size_of_htable = size_memory / sizeof(Bucket*);
-    size_t full = HASH_TABLE_LOAD_FACTOR * size_of_htable;
-    Htable* table = construct_Htable(size_of_htable);
+int build_and_probe(RowReader* in1, RowReader* in2, FILE* out, csv_const_row header1, csv_const_row header2,
+                    size_t col1, size_t col2, size_t budget, const JoinOptions* options, JoinStats* stats){
+    ProbeMarks marks = { NULL, 0, 0 };
+    size_t accumulators = options->mMode == JOIN_GROUP ? options->mAggregateCount : 0;
+    int filter = options->mMode == JOIN_SEMI || options->mMode == JOIN_ANTI;
+
+    // semi-join ou anti-join : si R1 demande plusieurs lots, marks prendra un bit par ligne
+    // de R2 ; le budget lui garde sa place dès le premier lot (une borne tant que le nombre
+    // de lignes de R2 n'est pas compté) pour qu'il ne grandisse pas pendant un scan
+    int marks_exact = 1;
+    size_t marks_bytes = filter && in2->mSeekable ? marks_reserve(in2, &marks_exact) : 0;
 
+    // la table commence petite et double tant que le budget le permet ; sans cela, la
+    // taille pour remplir tout le budget avec des lignes de la largeur de l'en-tête
+    size_t size = buckets_for_budget(budget, entry_footprint(header1));
+    Htable* table = construct_row_Htable(size < HASH_TABLE_INITIAL_SIZE ? size : HASH_TABLE_INITIAL_SIZE);
     if (table == NULL){
         fprintf(stderr, "On ne peut pas construire un hash table\n");
         return -1;
     }
 
+    KeyCodec codec;
+    init_KeyCodec(&codec, options->mKeyType);
+
+    int success = 0, batches = 0;
     csv_row rowR1;
-    write_rows(out, read_row(in1), read_row(in2), col2); // écrire en-tete
-    int count = 0; // nombre d'élement dans le hash table, pour comparer avec "full"
+    while(success == 0 && (rowR1 = reader_row(in1)) != NULL && strlen(rowR1) > 0) {
+        size_t len = 0;
+        uint64_t ticks = PROFILE_TICKS();
+        Bucket* bucket;
+        const char* field = reader_field(in1, rowR1, col1, &len);
+        size_t extra = accumulators == 0 ? 0 : accumulators_footprint(rowR1, accumulators);
+        size_t cost = row_footprint(table, &codec, rowR1, field, len, &bucket) + extra;
+        PROFILE_LAP(stats, PHASE_BUILD, ticks);
 
-    while(strlen(rowR1 = read_row(in1)) > 0) {
+        // l'entrée ne tient plus dans le budget => join, puis on recommence avec une table vide
+        // (les lignes retenues par le semi-join ou l'anti-join comptent aussi)
+        size_t used = table->mBytes + codec.mDict.mBytes + marks_bytes;
+        if (used + cost > budget && !marks_exact){  // la borne ne tient plus : on compte R2
+            marks_bytes = (count_reader_rows(in2) + 7) / 8;
+            marks_exact = 1;
+            used = table->mBytes + codec.mDict.mBytes + marks_bytes;
+        }
+        if (used + cost > budget && table->mCount > 0){
+            if (used > stats->mPeakBytes)
+                stats->mPeakBytes = used;
+            if (stats->mMinBuckets == 0 || table->mSize < stats->mMinBuckets) stats->mMinBuckets = table->mSize;
+            if (table->mSize > stats->mMaxBuckets) stats->mMaxBuckets = table->mSize;
+            if (codec.mDict.mCount > stats->mDictPeak)
+                stats->mDictPeak = codec.mDict.mCount;
+            stats->mAllocated += used;
+            if (!in2->mSeekable){   // R2 ne peut être lue qu'une fois => partitions
+                success = partition_join(table, &codec, rowR1, in1, in2, out, header1, header2,
+                                         col1, col2, budget, options, stats);
+                return success;
+            }
+            size_t average = (used - marks_bytes - Htable_overhead(table)) / table->mCount;
+            if (filter && marks.mBits == NULL && 0 != reserve_marks(&marks, marks_bytes)){
+                fprintf(stderr, "On ne peut pas retenir les lignes de R2 déjà écrites\n");
+                success = -1;
+                free(rowR1);
+                break;
+            }
+            stats->mRowsOut += join(table, &codec, in2, out, col2, options, &marks, batches++ > 0, 0, stats);
+            clear_Htable(table);
+            clear_Dictionary(&codec.mDict);   // les codes ne servent qu'au lot courant
 
-        if (0 == add_row_to_hashtable(table, rowR1, col1)) {
-            count++ ;
-        } else { // on ne peut pas ajouter R1 dans hash table => goto fail
-            fprintf(stderr, "On ne peut pas ajouter R1 dans hash table\n");
-            return -1;
+            // les lots suivants rempliront aussi le budget : on ajuste la taille de la table
+            // si elle est mauvaise d'un facteur 2 pour la taille moyenne observée
+            size = buckets_for_budget(budget, average);
+            if (size > 2 * table->mSize || 2 * size < table->mSize)
+                resize_empty_Htable(table, size);
+            ticks = PROFILE_TICKS();    // join() a compté son temps
+            cost = row_footprint(table, &codec, rowR1, field, len, &bucket) + extra;    // table vide
+        }
+        if (table->mBytes + codec.mDict.mBytes + marks_bytes + cost > budget){
+            if (table->mBytes + codec.mDict.mBytes + cost <= budget)
+                fprintf(stderr, "Budget mémoire trop petit pour retenir les lignes de R2 (%zu octets)\n",
+                        marks_bytes);
+            else
+                fprintf(stderr, "Budget mémoire trop petit pour une seule ligne de R1\n");
+            free(rowR1);
+            success = -1;
+            break;
         }
-        // hash table est pleine => join
-        if (count==full){ 
-            join(table, in2, out, col2);
-            count = 0;
+        if (accumulators > 0){  // group-join : les accumulateurs suivent la ligne
+            csv_row bigger = attach_accumulators(rowR1, accumulators);
+            if (bigger == NULL){
+                fprintf(stderr, "On ne peut pas ajouter R1 dans hash table\n");
+                free(rowR1);
+                success = -1;
+                break;
+            }
+            rowR1 = bigger;
+            field = reader_field(in1, rowR1, col1, &len);
+        }
+
+        // le tableau peut doubler si la ligne, sa key et le nouveau tableau tiennent encore
+        // (une key déjà présente n'ajoute pas de bucket : la limite ne sert pas)
+        size_t key_cost = cost > entry_footprint(rowR1) ? cost - entry_footprint(rowR1) : 0;
+        table->mGrowLimit = budget - codec.mDict.mBytes - marks_bytes - key_cost;
+        switch (add_row_to_hashtable(table, &codec, rowR1, field, len, col1,
+                                     options->mMode == JOIN_SEMI || options->mMode == JOIN_ANTI, &bucket)) {
+        case 0:
+            stats->mRowsR1++;
+            table->mBytes += extra;
+            break;
+        case 2:     // semi-join ou anti-join : seule la key compte
+            stats->mRowsR1++;
+            free(rowR1);
+            break;
+        case 1:     // key absente ou qui n'est pas un entier => ligne ignorée
+            if (stats->mBadKeys++ == 0)
+                fprintf(stderr, "Ligne de R1 ignorée, key invalide en colonne %zu : \"%s\"\n", col1, rowR1);
+            free(rowR1);
+            break;
+        default:    // on ne peut pas ajouter R1 dans hash table => goto fail
+            fprintf(stderr, "On ne peut pas ajouter R1 dans hash table\n");
+            free(rowR1);
+            success = -1;
         }
+        PROFILE_LAP(stats, PHASE_BUILD, ticks);
     }
+    if (success == 0){
+        free(rowR1);
 
-    if (count != 0) // R1 a été entièrement scannée, si hash table n'est pas vide, on fait join encore une fois
-        join(table, in2, out, col2);
+        size_t used = table->mBytes + codec.mDict.mBytes + marks.mBytes;
+        if (used > stats->mPeakBytes)
+            stats->mPeakBytes = used;
+        if (stats->mMinBuckets == 0 || table->mSize < stats->mMinBuckets) stats->mMinBuckets = table->mSize;
+        if (table->mSize > stats->mMaxBuckets) stats->mMaxBuckets = table->mSize;
+        if (codec.mDict.mCount > stats->mDictPeak)
+            stats->mDictPeak = codec.mDict.mCount;
+        stats->mAllocated += used;
+        // R1 a été entièrement scannée, si hash table n'est pas vide, on fait join encore une fois
+        // (l'anti-join écrit toujours les lignes de R2 qui n'ont correspondu à rien)
+        if (table->mCount != 0 || options->mMode == JOIN_ANTI)
+            stats->mRowsOut += join(table, &codec, in2, out, col2, options, &marks, batches++ > 0, 1, stats);
+        if (codec.mType != KEY_AUTO)
+            stats->mKeyType = codec.mType;
+    }
 
+    if (marks.mFailed){
+        fprintf(stderr, "On ne peut pas retenir les lignes de R2 déjà écrites\n");
+        success = -1;
+    }
+    free(marks.mBits);
+    add_probe_counts(stats, table);
     delete_Htable_and_content(table);
-    return 0;
+    clear_Dictionary(&codec.mDict);
+    return success;
 }
 
-// fonction qui lit R2 et écrire le résultat dans "out"
+// fonction qui lit R2 et écrire le résultat dans "out" (cf. probe_row)
+// si again, R2 a déjà été lue par un lot précédent : on revient au début et on saute l'en-tête
+// last : R1 a été entièrement lue ; marks sert au semi-join et à l'anti-join s'il y a
+// plusieurs lots, et au group-join les agrégats sont écrits à la fin du scan
+// return le nombre de lignes écrites
 
-void join(Htable* table, FILE* in, FILE* out, size_t col){
-    fseek(in, 0, SEEK_SET);
-    csv_row row = read_row(in); //ignore header
+size_t join(Htable* table, const KeyCodec* codec, RowReader* in, FILE* out, size_t col, const JoinOptions* options,
+            ProbeMarks* marks, int again, int last, JoinStats* stats){
+    size_t written = 0, index = 0;
+    csv_row row;
+    if (!again && last)
+        marks = NULL;   // un seul lot
+    if (again){
+        rewind_reader(in);
+        row = reader_row(in); //ignore header
+        free(row);
+    }
+    stats->mBatches++;
 
-    while(strlen(row = read_row(in)) > 0){
-        char* key = row_element(row, col);
-        csv_const_row value = get_Htable_value(table, key);
-        if (value != NULL)
-            write_rows(out, value, row, col);
-        free(key);
+    ProbeField field;
+    while(next_probe_row(in, col, &row, &field)){
+        stats->mRowsR2++;
+        key_word key;
+        uint64_t ticks = PROFILE_TICKS();
+        const Bucket* bucket = NULL;
+        if (0 == encode_probe_field(codec, &field, &key)){
+            PROFILE_LAP(stats, PHASE_HASH, ticks);
+            bucket = get_Htable_bucket(table, key);
+            PROFILE_LAP(stats, PHASE_PROBE, ticks);
+        }
+        if (bucket != NULL)
+            stats->mMatches++;
+        // depuis le cache colonnes, seule une ligne qui peut être écrite est reconstruite
+        if (row == NULL && (bucket != NULL) != (options->mMode == JOIN_ANTI)
+            && (row = columns_current_row(in)) == NULL)
+            break;
+        if (row != NULL)
+            written += probe_row(out, options, bucket, row, col, marks, index, last);
+        else if (marks != NULL && bucket != NULL)
+            mark_row(marks, index);     // anti-join : la ligne ne sera pas écrite
+        index++;
+        free(row);
+        PROFILE_LAP(stats, PHASE_WRITE, ticks);
     }
-    // remis hash table à zero 
-    size_t size = table->mSize;
-    delete_Htable_and_content(table);
-    table = construct_Htable(size);
-    if (table == NULL)
-        fprintf(stderr, "On ne peut pas remettre hash table à zero.\n");
+    if (options->mMode == JOIN_GROUP){
+        uint64_t ticks = PROFILE_TICKS();
+        written += emit_groups(table, out, options);
+        PROFILE_LAP(stats, PHASE_WRITE, ticks);
+    }
+    return written;
 }
 
-// fonction pour ajouter une ligne csv dans le hash table
-// return 0 si réussit 
+// fonction qui choisit la partition d'une key ; les entiers déclarés (KEY_INT) sont
+// répartis selon leur valeur, pour que "007" et "7" tombent dans la même partition
+// (les bits de poids fort du hash, indépendants de l'indice dans la table) ; les
+// partitions d'une partition (level > 0) sont choisies par un autre hash
+// return (size_t) -1 si la key ne peut correspondre à aucune autre
 
-int add_row_to_hashtable(Htable* table, csv_row row, size_t col){
-    int success;
-    char* key = row_element(row, col);
-    if (key != NULL)
-        success = add_Htable_value(table, key, row);    
+size_t partition_of(KeyType type, const char* field, size_t len, size_t count, size_t level){
+    int64_t value;
+    size_t hash;
+    if (type != KEY_INT)
+        hash = hash_bytes(field, len);
+    else if (0 != parse_int_key(field, len, 0, &value))
+        return (size_t) -1;
     else
-        success = -1;
-    return success;
+        hash = hash_word((key_word) value, SIZE_MAX) >> 40;
+    if (level > 0)
+        hash = hash_word(hash + level, SIZE_MAX) >> 40;
+    return hash % count;
 }
 
-/* ======================================================================
- * Provided: main()
- * ======================================================================
- */
+// fonction qui choisit le nombre de partitions pour que la partie de R1 de chacune tienne
+// en un seul lot, avec de la marge dans la moitié du budget (l'autre moitié au plus va aux
+// tampons d'écriture des fichiers temporaires), d'après ce que la table pleine a déjà
+// consommé pour les lignes lues jusqu'ici ; une partition trop grosse est répartie à son tour
+// return 0 si le budget ne suffit pas aux tampons de SPILL_MIN_PARTITIONS partitions
 
-int main(void)
-{
-    FILE* in1 = ask_filename_and_open("Entrez le nom du premier fichier : ", "r");
-    if (in1 == NULL) {
-        return EXIT_FAILURE;
+size_t choose_partitions(const RowReader* in1, const Htable* table, size_t used, size_t budget){
+    struct stat st;
+    double ratio = 0;   // taille de R1 / ce qui est dans la table
+    if (in1->mColumns.mBase != NULL){
+        ratio = (double) in1->mColumns.mHeader->mRowCount / (table->mRows + 1);
+    } else if ((in1->mAhead == NULL || in1->mAhead->mFormat == INPUT_PLAIN)
+               && 0 == fstat(fileno(in1->mFile), &st) && S_ISREG(st.st_mode)){
+        size_t read = 0, i, j, count;
+        const Bucket* bucket;
+        const void* const* rows;
+        for (i = 0; i < table->mSize; i++)
+            for (bucket = table->mListOfBucket[i]; bucket != NULL; bucket = bucket->mNext)
+                for (j = 0, count = bucket_rows(bucket, &rows); j < count; j++)
+                    read += strlen(rows[j]) + 1;
+        ratio = read == 0 ? 0 : (double) st.st_size / read;
     }
+    // au-delà, les tampons minimaux dépasseraient leur moitié du budget
+    size_t limit = budget / (4 * ALLOC_SIZE(SPILL_MIN_BUFFER));
+    if (limit < SPILL_MIN_PARTITIONS)
+        return 0;
+    if (limit > SPILL_MAX_PARTITIONS)
+        limit = SPILL_MAX_PARTITIONS;
+    double count = ratio == 0 ? SPILL_DEFAULT_PARTITIONS : ratio * used / (budget / 2) + 1;
+    if (count > limit)
+        count = limit;
+    return count < SPILL_MIN_PARTITIONS ? SPILL_MIN_PARTITIONS : (size_t) count;
+}
 
-    FILE* in2 = ask_filename_and_open("Entrez le nom du second  fichier : ", "r");
-    if (in2 == NULL) {
-        fclose(in1);
-        return EXIT_FAILURE;
-    }
+// fonction qui écrit une ligne dans la partition de sa key
+// return 0 si réussit, 1 si la ligne est ignorée (key invalide), -1 en cas d'erreur d'écriture
 
-    FILE* out = ask_filename_and_open("Entrez le nom du fichier où écrire le résultat : ", "w");
-    if (out == NULL) {
-        fclose(in1);
-        fclose(in2);
-        return EXIT_FAILURE;
+int spill_row(FILE** partitions, size_t count, size_t level, KeyType type, csv_const_row row, const char* field,
+              size_t len){
+    if (field == NULL)
+        return 1;
+    size_t i = partition_of(type, field, len, count, level);
+    if (i == (size_t) -1)
+        return 1;
+    if (EOF == fputs(row, partitions[i]) || EOF == fputc('\n', partitions[i]))
+        return -1;
+    return 0;
+}
+
+// fonction pour garder une partition entièrement écrite sans son tampon : le FILE* est
+// fermé (le tampon peut être libéré), le fichier reste ouvert par un autre descripteur
+// return le descripteur, -1 si on ne peut pas
+
+int detach_spill(FILE* f){
+    int fd = -1;
+    if (0 == fflush(f))
+        fd = dup(fileno(f));
+    fclose(f);
+    return fd;
+}
+
+// fonction pour relire depuis le début une partition gardée par detach_spill, avec le
+// tampon buffer de size octets (le descripteur est fermé avec le FILE*)
+// return le FILE*, NULL si on ne peut pas (le descripteur est alors fermé)
+
+FILE* reopen_spill(int fd, char* buffer, size_t size){
+    FILE* f = NULL;
+    if (fd < 0)
+        return NULL;
+    if (-1 == lseek(fd, 0, SEEK_SET) || (f = fdopen(fd, "r")) == NULL){
+        close(fd);
+        return NULL;
     }
+    setvbuf(f, buffer, _IOFBF, size);
+    return f;
+}
+
+// fonction pour préparer le repérage des keys très fréquentes ; le sketch prend au
+// plus bytes octets (SKETCH_MIN_WIDTH colonnes au moins)
+// return 0 si réussit, -1 si bytes ne suffit pas au plus petit sketch
 
-    size_t col1 = ask_size_t("Entrez l'index de la colonne à joindre dans le premier fichier : "),
-           col2 = ask_size_t("Entrez l'index de la colonne à joindre dans le second  fichier : ");
+int init_HeavyHitters(HeavyHitters* heavy, size_t bytes){
+    memset(heavy, 0, sizeof(*heavy));
+    init_KeyCodec(&heavy->mCodec, KEY_STRING);
+    if (ALLOC_SIZE(SKETCH_DEPTH * SKETCH_MIN_WIDTH * sizeof(uint32_t)) > bytes)
+        return -1;
+    heavy->mWidth = SKETCH_MIN_WIDTH;
+    while (2 * heavy->mWidth <= SKETCH_MAX_WIDTH && SKETCH_DEPTH * 2 * heavy->mWidth * sizeof(uint32_t) <= bytes)
+        heavy->mWidth *= 2;
+    heavy->mCounts = calloc(SKETCH_DEPTH * heavy->mWidth, sizeof(uint32_t));
+    return heavy->mCounts == NULL ? -1 : 0;
+}
+
+// fonction pour libérer le sketch, les candidates et les lignes de R1 chargées
+
+void clear_HeavyHitters(HeavyHitters* heavy){
+    size_t i;
+    free(heavy->mCounts);
+    heavy->mCounts = NULL;
+    for (i = 0; i < heavy->mCount; i++)
+        free(heavy->mKeys[i]);
+    heavy->mCount = 0;
+    heavy->mHotCount = 0;
+    if (heavy->mTable != NULL)
+        delete_Htable_and_content(heavy->mTable);
+    heavy->mTable = NULL;
+    clear_Dictionary(&heavy->mCodec.mDict);
+}
+
+// fonction qui compare deux keys comme le join : par valeur pour KEY_INT déclaré,
+// octet par octet sinon (KEY_AUTO ne déduit des entiers que s'ils sont canoniques)
+// return 1 si elles sont égales
+
+int same_key(KeyType type, const char* a, size_t a_len, const char* b, size_t b_len){
+    int64_t x, y;
+    if (type == KEY_INT)
+        return 0 == parse_int_key(a, a_len, 0, &x) && 0 == parse_int_key(b, b_len, 0, &y) && x == y;
+    return a_len == b_len && 0 == memcmp(a, b, a_len);
+}
 
-    int success = hash_join(in1, in2, out, col1, col2,
-                            ask_size_t("Entrez le budget mémoire autorisé (en octets) : ")
-                            );
+// fonction pour compter une key de l'échantillon dans le sketch ; elle devient candidate
+// si son estimation est l'une des HEAVY_MAX_KEYS plus grandes
+
+void sketch_row(HeavyHitters* heavy, KeyType type, const char* field, size_t len){
+    int64_t value;
+    key_word hash;
+    if (type == KEY_INT){
+        if (0 != parse_int_key(field, len, 0, &value))
+            return;     // ne correspond à aucune ligne de R1
+        hash = (key_word) value;
+    } else
+        hash = hash_bytes(field, len);
+
+    // une ligne du sketch par fonction de hash ; l'estimation est le plus petit compteur
+    size_t estimate = SIZE_MAX, i, smallest = 0;
+    for (i = 0; i < SKETCH_DEPTH; i++){
+        uint32_t* counter = &heavy->mCounts[i * heavy->mWidth
+                                            + hash_word(hash + i * 0x9e3779b97f4a7c15ULL, heavy->mWidth)];
+        if (*counter < UINT32_MAX)
+            (*counter)++;
+        if (*counter < estimate)
+            estimate = *counter;
+    }
+    for (i = 0; i < heavy->mCount; i++){
+        if (same_key(type, heavy->mKeys[i], heavy->mLens[i], field, len)){
+            heavy->mEstimates[i] = estimate;
+            return;
+        }
+        if (heavy->mEstimates[i] < heavy->mEstimates[smallest])
+            smallest = i;
+    }
+    if (heavy->mCount == HEAVY_MAX_KEYS && estimate <= heavy->mEstimates[smallest])
+        return;
+    char* copy = malloc(len + 1);
+    if (copy == NULL)
+        return;         // le repérage est une optimisation : on garde les candidates actuelles
+    memcpy(copy, field, len);
+    copy[len] = '\0';
+    if (heavy->mCount < HEAVY_MAX_KEYS)
+        smallest = heavy->mCount++;
+    else
+        free(heavy->mKeys[smallest]);
+    heavy->mKeys[smallest] = copy;
+    heavy->mLens[smallest] = len;
+    heavy->mEstimates[smallest] = estimate;
+}
+
+// fonction pour retenir les candidates dont l'estimation atteint threshold et les encoder
+// (par valeur pour KEY_INT déclaré, en chaînes sinon) ; le sketch est libéré
+// return le nombre de keys retenues, -1 si on ne peut pas allouer
+
+int choose_heavy_keys(HeavyHitters* heavy, KeyType type, size_t threshold){
+    size_t i;
+    free(heavy->mCounts);
+    heavy->mCounts = NULL;
+    heavy->mCodec.mType = (type == KEY_INT) ? KEY_INT : KEY_STRING;
+    heavy->mHotCount = 0;
+    for (i = 0; i < heavy->mCount; i++){
+        if (heavy->mEstimates[i] < threshold){
+            free(heavy->mKeys[i]);
+            continue;
+        }
+        size_t j = heavy->mHotCount++;     // les keys retenues passent devant
+        heavy->mKeys[j] = heavy->mKeys[i];
+        heavy->mLens[j] = heavy->mLens[i];
+        heavy->mEstimates[j] = heavy->mEstimates[i];
+        if (0 != encode_build_key(&heavy->mCodec, heavy->mKeys[j], heavy->mLens[j], &heavy->mHot[j])){
+            for (i++; i < heavy->mCount; i++)
+                free(heavy->mKeys[i]);
+            heavy->mCount = heavy->mHotCount;
+            heavy->mHotCount = 0;
+            return -1;
+        }
+    }
+    heavy->mCount = heavy->mHotCount;
+    return (int) heavy->mHotCount;
+}
+
+// fonction pour savoir si une key est l'une des keys retenues (encodée dans *key)
+// return 1 si oui
+
+int is_heavy_key(const HeavyHitters* heavy, const char* field, size_t len, key_word* key){
+    size_t i;
+    if (heavy->mHotCount == 0 || field == NULL || 0 != encode_probe_key(&heavy->mCodec, field, len, key))
+        return 0;
+    for (i = 0; i < heavy->mHotCount; i++)
+        if (heavy->mHot[i] == *key)
+            return 1;
+    return 0;
+}
+
+// fonction qui sort des partitions de R1 les lignes des keys retenues et les charge dans
+// heavy->mTable, avec accumulators accumulateurs (group-join) : chaque partition concernée
+// (spill1, de niveau level, avec ses tampons buffers1) est recopiée sans elles, dans un
+// nouveau tampon de buffer octets. Si ces lignes et ces tampons prennent plus de limit
+// octets, on y renonce : aucune key n'est retenue et les partitions restent telles quelles
+// return 0 si réussit (même si on renonce), -1 en cas d'erreur
+
+int split_heavy_rows(HeavyHitters* heavy, FILE** spill1, char** buffers1, size_t count, size_t level, KeyType type,
+                     size_t col1, csv_const_row header1, size_t buffer, size_t limit, size_t accumulators){
+    FILE** copies = calloc(count, sizeof(FILE*));
+    char** buffers = calloc(count, sizeof(char*));
+    heavy->mTable = construct_row_Htable(2 * HEAVY_MAX_KEYS);
+    int success = (copies == NULL || buffers == NULL || heavy->mTable == NULL) ? -1 : 0, fits = 1;
+    size_t i, len = 0, copied = 0;
+
+    for (i = 0; success == 0 && fits && i < heavy->mHotCount; i++){
+        size_t p = partition_of(type, heavy->mKeys[i], heavy->mLens[i], count, level);
+        if (p == (size_t) -1 || copies[p] != NULL)
+            continue;
+        if ((buffers[p] = malloc(buffer)) == NULL || (copies[p] = tmpfile()) == NULL){
+            perror("tmpfile");
+            success = -1;
+            break;
+        }
+        setvbuf(copies[p], buffers[p], _IOFBF, buffer);
+        copied += ALLOC_SIZE(buffer);
+        fprintf(copies[p], "%s\n", header1);
+
+        RowReader part;
+        rewind(spill1[p]);
+        open_reader(&part, spill1[p], NULL, 0, 0);
+        free(reader_row(&part));    // en-tête
+        while (success == 0 && fits){
+            csv_row row = reader_row(&part);
+            if (row == NULL || strlen(row) == 0){
+                free(row);
+                break;
+            }
+            key_word key;
+            Bucket* bucket;
+            const char* field = reader_field(&part, row, col1, &len);
+            if (!is_heavy_key(heavy, field, len, &key)){
+                if (EOF == fputs(row, copies[p]) || EOF == fputc('\n', copies[p]))
+                    success = -1;
+                free(row);
+                continue;
+            }
+            size_t extra = accumulators == 0 ? 0 : accumulators_footprint(row, accumulators);
+            if (heavy->mTable->mBytes + heavy->mCodec.mDict.mBytes + copied
+                + row_footprint(heavy->mTable, &heavy->mCodec, row, field, len, &bucket) + extra > limit){
+                fits = 0;
+                free(row);
+                continue;
+            }
+            if (accumulators > 0){  // group-join : les accumulateurs suivent la ligne
+                csv_row bigger = attach_accumulators(row, accumulators);
+                if (bigger == NULL){
+                    success = -1;
+                    free(row);
+                    continue;
+                }
+                row = bigger;
+            }
+            if (0 != (bucket != NULL ? append_Bucket_value(heavy->mTable, bucket, row)
+                                     : add_Bucket(heavy->mTable, key, row))){
+                success = -1;
+                free(row);
+            } else
+                heavy->mTable->mBytes += extra;
+        }
+        close_reader(&part);
+    }
+
+    if (success == 0 && fits){      // les partitions recopiées remplacent les anciennes
+        for (i = 0; i < count; i++){
+            if (copies[i] != NULL){
+                fclose(spill1[i]);
+                free(buffers1[i]);
+                spill1[i] = copies[i];
+                buffers1[i] = buffers[i];
+                copies[i] = NULL;
+                buffers[i] = NULL;
+            }
+        }
+    } else {
+        heavy->mHotCount = 0;
+        if (heavy->mTable != NULL)
+            delete_Htable_and_content(heavy->mTable);
+        heavy->mTable = NULL;
+    }
+    for (i = 0; copies != NULL && i < count; i++)
+        if (copies[i] != NULL)
+            fclose(copies[i]);
+    for (i = 0; buffers != NULL && i < count; i++)
+        free(buffers[i]);
+    free(copies);
+    free(buffers);
+    return success;
+}
+
+// fonction pour faire le join quand R1 ne tient pas dans le budget et que R2 ne peut
+// être lue qu'une fois (Grace hash join) : la table pleine, la ligne en attente et la
+// fin de R1 sont réparties dans des fichiers temporaires selon le hash de leur key,
+// R2 aussi en une seule lecture, puis chaque paire de partitions est jointe avec
+// build_and_probe (les fichiers temporaires, eux, peuvent être relus ; une partition qui ne
+// tient pas en un lot est à nouveau répartie, jusqu'à SPILL_MAX_LEVELS). Les keys très
+// fréquentes du début de R2 sont jointes pendant la lecture de R2, leurs lignes de R1
+// en mémoire : elles ne surchargent pas leur partition (cf. HeavyHitters)
+// la table et la ligne en attente sont libérées
+// return O si réussit
+
+int partition_join(Htable* table, KeyCodec* codec, csv_row pending, RowReader* in1, RowReader* in2, FILE* out,
+                   csv_const_row header1, csv_const_row header2, size_t col1, size_t col2, size_t budget,
+                   const JoinOptions* options, JoinStats* stats){
+    finish_rehash_Htable(table);    // on parcourt mListOfBucket
+    size_t count = choose_partitions(in1, table, table->mBytes + codec->mDict.mBytes, budget);
+    if (count == 0){
+        fprintf(stderr, "Budget mémoire trop petit pour répartir R1 et R2 sur disque : il faut plus de"
+                " %zu octets pour la table\n", 4 * SPILL_MIN_PARTITIONS * ALLOC_SIZE(SPILL_MIN_BUFFER));
+        delete_Htable_and_content(table);
+        clear_Dictionary(&codec->mDict);
+        free(pending);
+        return -1;
+    }
+    size_t level = in2->mSpillLevel;
+    FILE** spill1 = calloc(count, sizeof(FILE*));
+    FILE** spill2 = calloc(count, sizeof(FILE*));
+    char** buffers = calloc(2 * count, sizeof(char*));   // ceux de spill1, puis de spill2
+    KeyType type = options->mKeyType;
+    int success = (spill1 == NULL || spill2 == NULL || buffers == NULL) ? -1 : 0;
+    size_t i, len = 0;
+    const char* field;
+
+    // tampons des fichiers temporaires, alloués ici (stdio en prendrait de plus gros) :
+    // au plus un quart du budget pour chaque côté, arrondi de malloc compris, soit
+    // ALLOC_SIZE(buffer) <= budget / (4 * count) (count <= choose_partitions : au moins SPILL_MIN_BUFFER)
+    size_t buffer = budget / (4 * count) / 16 * 16 - sizeof(size_t);
+    if (buffer > BUFSIZ)
+        buffer = BUFSIZ;
+    for (i = 0; success == 0 && i < count; i++){
+        if ((buffers[i] = malloc(buffer)) == NULL || (buffers[count + i] = malloc(buffer)) == NULL
+            || (spill1[i] = tmpfile()) == NULL || (spill2[i] = tmpfile()) == NULL){
+            perror("tmpfile");
+            success = -1;
+        } else {
+            setvbuf(spill1[i], buffers[i], _IOFBF, buffer);
+            setvbuf(spill2[i], buffers[count + i], _IOFBF, buffer);
+            fprintf(spill1[i], "%s\n", header1);
+            fprintf(spill2[i], "%s\n", header2);
+        }
+    }
+
+    // R1 : la table, la ligne en attente, puis le reste
+    uint64_t ticks = PROFILE_TICKS();
+    for (i = 0; success == 0 && i < table->mSize; i++){
+        const Bucket* bucket;
+        for (bucket = table->mListOfBucket[i]; success == 0 && bucket != NULL; bucket = bucket->mNext){
+            const void* const* rows;
+            size_t rows_count = bucket_rows(bucket, &rows), j;
+            for (j = 0; success == 0 && j < rows_count; j++){
+                field = row_field(rows[j], col1, &len);
+                if (spill_row(spill1, count, level, type, rows[j], field, len) < 0)
+                    success = -1;
+            }
+        }
+    }
+    PROFILE_LAP(stats, PHASE_SPILL, ticks);
+    add_probe_counts(stats, table);
+    delete_Htable_and_content(table);
+    clear_Dictionary(&codec->mDict);
+
+    csv_row row = pending;
+    while (success == 0 && row != NULL && strlen(row) > 0){
+        ticks = PROFILE_TICKS();
+        field = reader_field(in1, row, col1, &len);
+        int spilled = spill_row(spill1, count, level, type, row, field, len);
+        if (spilled < 0)
+            success = -1;
+        else if (spilled > 0 && stats->mBadKeys++ == 0)
+            fprintf(stderr, "Ligne de R1 ignorée, key invalide en colonne %zu : \"%s\"\n", col1, row);
+        if (spilled == 0)
+            stats->mRowsR1++;
+        free(row);
+        PROFILE_LAP(stats, PHASE_SPILL, ticks);
+        row = reader_row(in1);
+    }
+    free(row);
+
+    // un échantillon du début de R2 (un huitième du budget) : les keys qui y occupent au
+    // moins la moitié d'une partition sont jointes à part, avec un quart du budget
+    HeavyHitters heavy;
+    csv_row* sample = NULL;
+    size_t sampled = 0, capacity = 0, sample_bytes = 0, next = 0;
+    int ended = 0;
+    if (0 == init_HeavyHitters(&heavy, budget / 16) && success == 0){
+        while (sampled < HEAVY_SAMPLE_ROWS && sample_bytes < budget / 8){
+            if (sampled == capacity){
+                csv_row* bigger = realloc(sample, (capacity == 0 ? 64 : 2 * capacity) * sizeof(csv_row));
+                if (bigger == NULL)
+                    break;
+                sample = bigger;
+                capacity = capacity == 0 ? 64 : 2 * capacity;
+            }
+            if ((row = reader_row(in2)) == NULL || strlen(row) == 0){
+                free(row);
+                ended = 1;
+                break;
+            }
+            sample[sampled++] = row;
+            sample_bytes += ALLOC_SIZE(strlen(row) + 1);
+            if ((field = row_field(row, col2, &len)) != NULL)
+                sketch_row(&heavy, type, field, len);
+        }
+        sample_bytes += ALLOC_SIZE(capacity * sizeof(csv_row))
+                        + ALLOC_SIZE(SKETCH_DEPTH * heavy.mWidth * sizeof(uint32_t));
+        int chosen = choose_heavy_keys(&heavy, type, sampled / (2 * count) + 2);
+        if (chosen > 0){
+            success = split_heavy_rows(&heavy, spill1, buffers, count, level, type, col1, header1, buffer,
+                                       budget / 4, options->mMode == JOIN_GROUP ? options->mAggregateCount : 0);
+            sample_bytes += (size_t) chosen * ALLOC_SIZE(buffer);   // tampons des partitions recopiées
+        }
+        stats->mHeavyKeys += heavy.mHotCount;
+    }
+
+    // R2, lue une seule fois : l'échantillon, puis le reste
+    while (success == 0){
+        if (next < sampled)
+            row = sample[next++];
+        else if (ended)
+            break;
+        else if ((row = reader_row(in2)) == NULL || strlen(row) == 0){
+            free(row);
+            break;
+        }
+        stats->mRowsR2++;
+        key_word key;
+        ticks = PROFILE_TICKS();
+        field = reader_field(in2, row, col2, &len);
+        if (is_heavy_key(&heavy, field, len, &key)){
+            PROFILE_LAP(stats, PHASE_HASH, ticks);
+            const Bucket* bucket = get_Htable_bucket(heavy.mTable, key);
+            PROFILE_LAP(stats, PHASE_PROBE, ticks);
+            if (bucket != NULL)
+                stats->mMatches++;
+            stats->mRowsOut += probe_row(out, options, bucket, row, col2, NULL, 0, 1);
+            stats->mHeavyRows++;
+            PROFILE_LAP(stats, PHASE_WRITE, ticks);
+        } else {
+            int spilled = spill_row(spill2, count, level, type, row, field, len);
+            PROFILE_LAP(stats, PHASE_SPILL, ticks);
+            if (spilled < 0)
+                success = -1;
+            else if (spilled > 0){  // key invalide : ne correspond à aucune ligne de R1
+                stats->mRowsOut += probe_row(out, options, NULL, row, col2, NULL, 0, 1);
+                PROFILE_LAP(stats, PHASE_WRITE, ticks);
+            }
+        }
+        free(row);
+    }
+    if (success == 0 && heavy.mTable != NULL && options->mMode == JOIN_GROUP){
+        ticks = PROFILE_TICKS();
+        stats->mRowsOut += emit_groups(heavy.mTable, out, options);
+        PROFILE_LAP(stats, PHASE_WRITE, ticks);
+    }
+    if (success != 0)
+        fprintf(stderr, "On ne peut pas écrire les partitions sur disque\n");
+    for (; next < sampled; next++)
+        free(sample[next]);
+    free(sample);
+    if (heavy.mTable != NULL){
+        sample_bytes += heavy.mTable->mBytes + heavy.mCodec.mDict.mBytes;
+        stats->mAllocated += heavy.mTable->mBytes + heavy.mCodec.mDict.mBytes;
+        add_probe_counts(stats, heavy.mTable);
+    }
+    clear_HeavyHitters(&heavy);
+
+    // les partitions sont écrites : elles ne gardent que leur descripteur, les tampons
+    // d'écriture (au plus la moitié du budget) sont rendus, et chaque paire est relue
+    // avec deux tampons de la même taille
+    stats->mPartitions += count;
+    size_t buffer_bytes = 2 * count * ALLOC_SIZE(buffer);     // <= budget / 2
+    if (sample_bytes + buffer_bytes > stats->mPeakBytes)
+        stats->mPeakBytes = sample_bytes + buffer_bytes;
+    int* fds = success == 0 ? malloc(2 * count * sizeof(int)) : NULL;
+    char* reading = success == 0 ? malloc(2 * buffer) : NULL;
+    size_t detached = 0;    // descripteurs de fds, ceux de spill1 puis de spill2
+    if (fds == NULL || reading == NULL)
+        success = -1;
+    for (; success == 0 && detached < 2 * count; detached++){
+        FILE** spill = detached < count ? &spill1[detached] : &spill2[detached - count];
+        fds[detached] = detach_spill(*spill);
+        *spill = NULL;
+        free(buffers[detached]);
+        buffers[detached] = NULL;
+        if (fds[detached] < 0){
+            perror("dup");
+            success = -1;
+        }
+    }
+
+    size_t partition_budget = budget - ALLOC_SIZE(2 * buffer);
+    size_t peak = stats->mPeakBytes;
+    stats->mPeakBytes = 0;
+    for (i = 0; success == 0 && i < count; i++){
+        FILE* file1 = reopen_spill(fds[i], reading, buffer);
+        FILE* file2 = reopen_spill(fds[count + i], reading + buffer, buffer);
+        fds[i] = fds[count + i] = -1;   // fermés avec file1 et file2
+        if (file1 == NULL || file2 == NULL){
+            perror("fdopen");
+            if (file1 != NULL) fclose(file1);
+            if (file2 != NULL) fclose(file2);
+            success = -1;
+            break;
+        }
+        RowReader part1, part2;
+        open_reader(&part1, file1, NULL, 0, 0);
+        open_reader(&part2, file2, NULL, 0, 0);
+        // une partition trop grosse pour un lot sera répartie à son tour plutôt que sa
+        // partie de R2 relue à chaque lot, si le budget suffit à d'autres tampons
+        part1.mSpillLevel = part2.mSpillLevel = level + 1;
+        if (part2.mSpillLevel < SPILL_MAX_LEVELS
+            && partition_budget / (4 * ALLOC_SIZE(SPILL_MIN_BUFFER)) >= SPILL_MIN_PARTITIONS)
+            part2.mSeekable = 0;
+        free(reader_row(&part1));   // en-têtes
+        free(reader_row(&part2));
+        size_t rows = stats->mRowsR1;
+        success = build_and_probe(&part1, &part2, out, header1, header2, col1, col2, partition_budget,
+                                  options, stats);
+        stats->mRowsR1 = rows;      // déjà comptées au moment de la répartition
+#ifndef CSV_JOIN_NO_PROFILE
+        stats->mProfile.mTicks[PHASE_READ_R1] += part1.mTicks;
+        stats->mProfile.mTicks[PHASE_READ_R2] += part2.mTicks;
+#endif
+        close_reader(&part1);
+        close_reader(&part2);
+        fclose(file1);
+        fclose(file2);
+    }
+    if (stats->mPeakBytes + ALLOC_SIZE(2 * buffer) > peak)
+        peak = stats->mPeakBytes + ALLOC_SIZE(2 * buffer);
+    stats->mPeakBytes = peak;
+    for (i = 0; i < count; i++){
+        if (spill1 != NULL && spill1[i] != NULL) fclose(spill1[i]);
+        if (spill2 != NULL && spill2[i] != NULL) fclose(spill2[i]);
+    }
+    for (i = 0; i < detached; i++)
+        if (fds[i] >= 0) close(fds[i]);
+    for (i = 0; buffers != NULL && i < 2 * count; i++)   // après les fclose qui les vident
+        free(buffers[i]);
+    free(buffers);
+    free(fds);
+    free(reading);
+    free(spill1);
+    free(spill2);
+    return success;
+}
+
+// fonction pour ajouter une ligne csv dans le hash table
+// field et len : la key de la ligne, dans la colonne col (NULL si absente) ; si unique,
+// une ligne dont la key est déjà dans la table n'est pas ajoutée ; known : NULL pour
+// chercher la key, sinon le bucket trouvé par row_footprint pour cette ligne (NULL si
+// la key n'est pas dans la table), qu'on ne cherche pas une seconde fois
+// return 0 si réussit, 1 si la ligne n'a pas de key valide, 2 si elle n'est pas ajoutée
+//        (unique), -1 si on ne peut pas allouer
+
+int add_row_to_hashtable(Htable* table, KeyCodec* codec, csv_row row, const char* field, size_t len, size_t col,
+                         int unique, Bucket* const* known){
+    if (field == NULL)
+        return 1;
+    if (known != NULL && *known != NULL){   // la key est déjà encodée dans son bucket
+        if (unique)
+            return 2;
+        return append_Bucket_value(table, *known, row) == 0 ? 0 : -1;
+    }
+
+    key_word key;
+    int success = encode_build_key(codec, field, len, &key);
+    if (success == 2){ // les keys ne sont finalement pas toutes des entiers
+        if (0 != rekey_Htable(table, codec, col))
+            return -1;
+        success = encode_build_key(codec, field, len, &key);
+        known = NULL;
+    }
+    if (success != 0)
+        return success;
+    if (known != NULL)      // row_footprint ne l'a pas trouvée
+        return add_Bucket(table, key, row) == 0 ? 0 : -1;
+    if (unique && find_Htable_bucket(table, key) != NULL)
+        return 2;
+    return add_Htable_value(table, key, row) == 0 ? 0 : -1;
+}
+
+// fonction pour afficher le plan choisi et les statistiques du join
+
+void print_join_stats(FILE* f, const JoinStats* stats){
+    if (stats->mBudget == 0)    // join avec un index persistant
+        fprintf(f, "Plan : index projeté, table de %zu buckets\n", stats->mMaxBuckets);
+    else
+        fprintf(f, "Plan : budget %zu octets, %zu lot(s), table de %zu à %zu buckets\n",
+                stats->mBudget, stats->mBatches, stats->mMinBuckets, stats->mMaxBuckets);
+    fprintf(f, "       %zu lignes R1, %zu lignes R2 lues, %zu lignes écrites, pic %zu octets\n",
+            stats->mRowsR1, stats->mRowsR2, stats->mRowsOut, stats->mPeakBytes);
+    if (stats->mKeyType == KEY_INT)
+        fprintf(f, "       keys entières");
+    else
+        fprintf(f, "       keys chaînes, jusqu'à %zu dans le dictionnaire", stats->mDictPeak);
+    fprintf(f, ", %zu ligne(s) de R1 ignorée(s)\n", stats->mBadKeys);
+    if (stats->mPartitions > 0)
+        fprintf(f, "       R2 lue une seule fois : %zu partitions sur disque\n", stats->mPartitions);
+    if (stats->mHeavyKeys > 0)
+        fprintf(f, "       %zu key(s) très fréquente(s) jointe(s) en mémoire : %zu lignes de R2 hors partitions\n",
+                stats->mHeavyKeys, stats->mHeavyRows);
+    print_profile(f, stats);
+}
+
+/* ======================================================================
+ * Part II bis -- Semi-join, anti-join and group-join
+ * ======================================================================
+ */
+
+// fonction qui retourne la position des accumulateurs dans une ligne de R1 : après son
+// '\0', alignée pour un Accumulator
+
+size_t accumulators_offset(csv_const_row row){
+    return (strlen(row) + 1 + sizeof(Accumulator) - 1) / sizeof(Accumulator) * sizeof(Accumulator);
+}
+
+// fonction qui retourne les octets que attach_accumulators ajoute à une ligne
+
+size_t accumulators_footprint(csv_const_row row, size_t count){
+    return ALLOC_SIZE(accumulators_offset(row) + count * sizeof(Accumulator)) - ALLOC_SIZE(strlen(row) + 1);
+}
+
+// fonction pour agrandir la copie d'une ligne de R1 et y ranger count accumulateurs à zéro
+// return la ligne agrandie, NULL si on ne peut pas allouer (la ligne reste valide)
+
+csv_row attach_accumulators(csv_row row, size_t count){
+    size_t offset = accumulators_offset(row);
+    csv_row bigger = realloc(row, offset + count * sizeof(Accumulator));
+    if (bigger != NULL)
+        memset(bigger + offset, 0, count * sizeof(Accumulator));
+    return bigger;
+}
+
+// fonction qui retourne les accumulateurs d'une ligne de R1 (cf. attach_accumulators)
+
+Accumulator* row_accumulators(csv_const_row row){
+    return (Accumulator*) (row + accumulators_offset(row));
+}
+
+// fonction pour lire un nombre dans [s, s + len)
+// return 0 si c'est un entier (*integer et *real), 1 si c'est un réel (*real),
+//        -1 si ce n'est pas un nombre (champ vide compris)
+
+int parse_number(const char* s, size_t len, int64_t* integer, double* real){
+    char text[64];
+    char* end = NULL;
+    if (0 == parse_int_key(s, len, 0, integer)){
+        *real = (double) *integer;
+        return 0;
+    }
+    if (len == 0 || len >= sizeof(text))
+        return -1;
+    memcpy(text, s, len);
+    text[len] = '\0';
+    *real = strtod(text, &end);
+    return (*end == '\0' && end != text) ? 1 : -1;
+}
+
+// fonction pour ajouter une ligne de R2 aux accumulateurs de sa key ; les champs qui
+// ne sont pas des nombres sont ignorés
+
+void accumulate(Accumulator* accumulators, const JoinOptions* options, csv_const_row probe){
+    size_t i, len = 0;
+    for (i = 0; i < options->mAggregateCount; i++){
+        const Aggregate* aggregate = &options->mAggregates[i];
+        Accumulator* acc = &accumulators[i];
+        int64_t integer = 0;
+        double real;
+        if (aggregate->mKind == AGG_COUNT){
+            acc->mCount++;
+            continue;
+        }
+        const char* field = row_field(probe, aggregate->mColumn, &len);
+        int kind = field == NULL ? -1 : parse_number(field, len, &integer, &real);
+        if (kind < 0)
+            continue;
+        if (aggregate->mKind == AGG_SUM){
+            if (kind != 0 || (integer > 0 && acc->mInt > INT64_MAX - integer)
+                || (integer < 0 && acc->mInt < INT64_MIN - integer))
+                acc->mIsReal = 1;   // la somme ne tient plus dans un entier
+            else
+                acc->mInt += integer;
+            acc->mReal += real;
+        } else if (acc->mCount == 0 || (aggregate->mKind == AGG_MIN ? real < acc->mReal : real > acc->mReal)){
+            acc->mInt = integer;
+            acc->mReal = real;
+            acc->mIsReal = (kind != 0);
+        }
+        acc->mCount++;
+    }
+}
+
+// fonction pour écrire les agrégats d'une key, chacun précédé du séparateur ; la somme,
+// le minimum et le maximum sont vides si aucune valeur n'a été vue
+
+void write_aggregates(FILE* out, const JoinOptions* options, const Accumulator* accumulators){
+    size_t i;
+    for (i = 0; i < options->mAggregateCount; i++){
+        const Accumulator* acc = &accumulators[i];
+        fputc(CSV_SEPARATOR, out);
+        if (options->mAggregates[i].mKind == AGG_COUNT)
+            fprintf(out, "%zu", acc->mCount);
+        else if (acc->mCount == 0)
+            continue;
+        else if (acc->mIsReal)
+            fprintf(out, "%.17g", acc->mReal);
+        else
+            fprintf(out, "%" PRId64, acc->mInt);
+    }
+}
+
+// fonction qui écrit chaque ligne de R1 de la table suivie des agrégats de sa key
+// (les accumulateurs sont dans la première ligne de la key)
+// return le nombre de lignes écrites
+
+size_t emit_groups(Htable* table, FILE* out, const JoinOptions* options){
+    size_t written = 0, i, j, count;
+    const Bucket* bucket;
+    const void* const* rows;
+    finish_rehash_Htable(table);
+    for (i = 0; i < table->mSize; i++){
+        for (bucket = table->mListOfBucket[i]; bucket != NULL; bucket = bucket->mNext){
+            count = bucket_rows(bucket, &rows);
+            const Accumulator* accumulators = row_accumulators(rows[0]);
+            for (j = 0; j < count; j++, written++){
+                fputs(rows[j], out);
+                write_aggregates(out, options, accumulators);
+                fputc('\n', out);
+            }
+        }
+    }
+    return written;
+}
+
+// fonction qui retourne les octets de marks pour les lignes de R2 (in, qu'on peut relire) :
+// exacts (*exact = 1) depuis le cache colonnes ou en comptant les lignes d'un CSV compressé,
+// sinon une borne tirée de la taille du fichier (*exact = 0) : une ligne non vide et son
+// '\n' font au moins 2 octets, soit au plus un octet de marks pour 16 octets de R2
+
+size_t marks_reserve(RowReader* in, int* exact){
+    struct stat st;
+    *exact = 1;
+    if (in->mColumns.mBase != NULL)
+        return (in->mColumns.mHeader->mRowCount + 7) / 8;
+    if ((in->mAhead == NULL || in->mAhead->mFormat == INPUT_PLAIN)
+        && 0 == fstat(fileno(in->mFile), &st) && S_ISREG(st.st_mode)){
+        *exact = 0;
+        return (size_t) st.st_size / 16 + 1;
+    }
+    return (count_reader_rows(in) + 7) / 8;
+}
+
+// fonction qui compte les lignes de données de la relation in (lue jusqu'à son
+// en-tête), comme les parcourt join(), puis revient juste après l'en-tête
+// return le nombre de lignes
+
+size_t count_reader_rows(RowReader* in){
+    size_t count = 0;
+    csv_row row;
+    if (in->mColumns.mBase != NULL)
+        return in->mColumns.mHeader->mRowCount;
+    rewind_reader(in);
+    free(reader_row(in));   // en-tête
+    while ((row = reader_row(in)) != NULL && strlen(row) > 0){
+        count++;
+        free(row);
+    }
+    free(row);
+    rewind_reader(in);
+    free(reader_row(in));
+    return count;
+}
+
+// fonction pour allouer marks d'un coup, vide, avant le premier scan de R2
+// return 0 si réussit
+
+int reserve_marks(ProbeMarks* marks, size_t bytes){
+    if ((marks->mBits = calloc(bytes > 0 ? bytes : 1, 1)) == NULL)
+        return -1;
+    marks->mBytes = bytes;
+    return 0;
+}
+
+// fonction pour retenir la ligne index de R2 dans marks (qui grandit s'il n'a pas
+// été réservé pour toutes les lignes)
+// return 0 si réussit (marks->mFailed sinon)
+
+int mark_row(ProbeMarks* marks, size_t index){
+    if (index / 8 >= marks->mBytes){
+        size_t bytes = marks->mBytes == 0 ? 1024 : 2 * marks->mBytes;
+        while (index / 8 >= bytes)
+            bytes *= 2;
+        unsigned char* bits = realloc(marks->mBits, bytes);
+        if (bits == NULL){
+            marks->mFailed = 1;
+            return -1;
+        }
+        memset(bits + marks->mBytes, 0, bytes - marks->mBytes);
+        marks->mBits = bits;
+        marks->mBytes = bytes;
+    }
+    marks->mBits[index / 8] |= (unsigned char) (1 << (index % 8));
+    return 0;
+}
+
+// fonction pour savoir si la ligne index de R2 est retenue dans marks
+// return 1 si oui
+
+int is_marked(const ProbeMarks* marks, size_t index){
+    return index / 8 < marks->mBytes && (marks->mBits[index / 8] >> (index % 8)) & 1;
+}
+
+// fonction qui écrit une ligne de R2 pour un semi-join ou un anti-join, selon que sa key
+// est dans la table (hit). Sans marks, R1 tient en un seul lot ; sinon la ligne index a
+// pu être retenue par un lot précédent : le semi-join l'écrit au premier lot où elle
+// correspond, l'anti-join au dernier lot (last) si elle n'a jamais correspondu
+// return 1 si la ligne a été écrite, 0 sinon
+
+size_t filter_row(FILE* out, JoinMode mode, int hit, csv_const_row row, ProbeMarks* marks, size_t index, int last){
+    int write;
+    if (marks == NULL)
+        write = (hit == (mode == JOIN_SEMI));
+    else if (hit){
+        write = (mode == JOIN_SEMI && !is_marked(marks, index));
+        mark_row(marks, index);
+    } else
+        write = (mode == JOIN_ANTI && last && !is_marked(marks, index));
+    if (write){
+        fputs(row, out);
+        fputc('\n', out);
+    }
+    return write ? 1 : 0;
+}
+
+// fonction qui traite une ligne de R2 selon le mode du join ; bucket est le bucket de sa
+// key dans la table, NULL si elle n'y est pas (marks, index et last : cf. filter_row)
+// return le nombre de lignes écrites
+
+size_t probe_row(FILE* out, const JoinOptions* options, const Bucket* bucket, csv_const_row row, size_t col,
+                 ProbeMarks* marks, size_t index, int last){
+    const void* const* rows;
+    size_t count, i, written = 0;
+    switch (options->mMode){
+    case JOIN_SEMI:
+    case JOIN_ANTI:
+        return filter_row(out, options->mMode, bucket != NULL, row, marks, index, last);
+    case JOIN_GROUP:
+        if (bucket != NULL){
+            bucket_rows(bucket, &rows);
+            accumulate(row_accumulators(rows[0]), options, row);
+        }
+        return 0;
+    default:
+        if (bucket == NULL)
+            return 0;
+        count = bucket_rows(bucket, &rows);
+        for (i = 0; i < count; i++)     // toutes les lignes de R1 qui ont cette key
+            written += emit_rows(out, options->mPipeline, rows[i], row, col, 0);
+        return written;
+    }
+}
+
+// fonction pour écrire l'en-tête du résultat : celui du join, celui de R2 (semi-join,
+// anti-join) ou celui de R1 suivi du nom des agrégats
+
+void emit_header(FILE* out, const JoinOptions* options, csv_const_row header1, csv_const_row header2, size_t col2){
+    size_t i, len = 0;
+    switch (options->mMode){
+    case JOIN_SEMI:
+    case JOIN_ANTI:
+        fprintf(out, "%s\n", header2);
+        break;
+    case JOIN_GROUP:
+        fputs(header1, out);
+        for (i = 0; i < options->mAggregateCount; i++){
+            const Aggregate* aggregate = &options->mAggregates[i];
+            static const char* names[] = { "count", "sum", "min", "max" };
+            fprintf(out, "%c%s", CSV_SEPARATOR, names[aggregate->mKind]);
+            if (aggregate->mKind == AGG_COUNT)
+                continue;
+            const char* name = row_field(header2, aggregate->mColumn, &len);
+            fputc('(', out);
+            if (name != NULL)
+                fwrite(name, 1, len, out);
+            fputc(')', out);
+        }
+        fputc('\n', out);
+        break;
+    default:
+        emit_rows(out, options->mPipeline, header1, header2, col2, 1);
+    }
+}
+
+// fonction pour lire un agrégat "count", "sum:COL", "min:COL" ou "max:COL"
+// return 0 si réussit
+
+int parse_aggregate(const char* text, Aggregate* aggregate){
+    static const char* names[] = { "count", "sum:", "min:", "max:" };
+    size_t i;
+    aggregate->mColumn = 0;
+    if (0 == strcmp(text, names[AGG_COUNT])){
+        aggregate->mKind = AGG_COUNT;
+        return 0;
+    }
+    for (i = AGG_SUM; i <= AGG_MAX; i++){
+        if (0 == strncmp(text, names[i], 4)){
+            aggregate->mKind = (AggregateKind) i;
+            return parse_size_t(text + 4, &aggregate->mColumn);
+        }
+    }
+    return -1;
+}
+
+/* ======================================================================
+ * Part II ter -- Instrumentation
+ * ======================================================================
+ */
+
+// fonction pour initialiser les statistiques d'un join (budget 0 : join avec un index)
+// et démarrer ses chronomètres
+
+void init_JoinStats(JoinStats* stats, size_t budget){
+    memset(stats, 0, sizeof(JoinStats));
+    stats->mBudget = budget;
+    stats->mKeyType = KEY_AUTO;
+#ifndef CSV_JOIN_NO_PROFILE
+    stats->mProfile.mStartNanoseconds = profile_nanoseconds();
+    stats->mProfile.mStartTicks = profile_ticks();
+#endif
+}
+
+// fonction pour arrêter les chronomètres d'un join et y ajouter le temps de lecture
+// de R1 et de R2 (in1 peut être NULL)
+
+void stop_JoinStats(JoinStats* stats, const RowReader* in1, const RowReader* in2){
+#ifndef CSV_JOIN_NO_PROFILE
+    Profile* profile = &stats->mProfile;
+    profile->mStopTicks = profile_ticks();
+    profile->mStopNanoseconds = profile_nanoseconds();
+    if (in1 != NULL){
+        profile->mTicks[PHASE_READ_R1] += in1->mTicks;
+        if (in1->mAhead != NULL)
+            profile->mTicks[PHASE_IO_WAIT] += in1->mAhead->mWaitTicks;
+    }
+    profile->mTicks[PHASE_READ_R2] += in2->mTicks;
+    if (in2->mAhead != NULL)
+        profile->mTicks[PHASE_IO_WAIT] += in2->mAhead->mWaitTicks;
+#else
+    (void) stats;
+    (void) in1;
+    (void) in2;
+#endif
+}
+
+// fonction qui lit le compteur de cycles du processeur (rdtsc, cntvct_el0), ou
+// l'horloge monotone en nanosecondes si on ne sait pas le lire
+
+uint64_t profile_ticks(void){
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    uint32_t low, high;
+    __asm__ __volatile__ ("rdtsc" : "=a" (low), "=d" (high));
+    return ((uint64_t) high << 32) | low;
+#elif defined(__GNUC__) && defined(__aarch64__)
+    uint64_t ticks;
+    __asm__ __volatile__ ("mrs %0, cntvct_el0" : "=r" (ticks));
+    return ticks;
+#else
+    return profile_nanoseconds();
+#endif
+}
+
+// fonction qui lit l'horloge monotone, en nanosecondes
+
+uint64_t profile_nanoseconds(void){
+    struct timespec now;
+    if (0 != clock_gettime(CLOCK_MONOTONIC, &now))
+        return 0;
+    return (uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec;
+}
+
+// fonction qui ajoute à la phase le temps écoulé depuis *start, et repart de maintenant
+
+void profile_lap(Profile* profile, Phase phase, uint64_t* start){
+    uint64_t now = profile_ticks();
+    profile->mTicks[phase] += now - *start;
+    *start = now;
+}
+
+// fonction pour ajouter aux statistiques les recherches faites dans une table de R1
+
+void add_probe_counts(JoinStats* stats, const Htable* table){
+#ifndef CSV_JOIN_NO_PROFILE
+    ProbeCounts* counts = &stats->mProfile.mProbes;
+    size_t i;
+    counts->mLookups += table->mProbes.mLookups;
+    counts->mHits += table->mProbes.mHits;
+    for (i = 0; i < HTABLE_PROBE_HISTOGRAM; i++)
+        counts->mLengths[i] += table->mProbes.mLengths[i];
+#else
+    (void) stats;
+    (void) table;
+#endif
+}
+
+// fonction qui convertit des ticks en secondes, d'après la durée totale du join
+// return 0 si le join n'a pas été chronométré
+
+double profile_seconds(const Profile* profile, uint64_t ticks){
+    uint64_t elapsed = profile->mStopTicks - profile->mStartTicks;
+    if (elapsed == 0)
+        return 0;
+    return (double) ticks * (double) (profile->mStopNanoseconds - profile->mStartNanoseconds) / elapsed / 1e9;
+}
+
+// fonction pour afficher le temps de chaque phase et les recherches dans la table
+
+void print_profile(FILE* f, const JoinStats* stats){
+#ifndef CSV_JOIN_NO_PROFILE
+    const Profile* p = &stats->mProfile;
+    const ProbeCounts* counts = &p->mProbes;
+    fprintf(f, "       temps %.3f s : lecture R1 %.3f s, R2 %.3f s (dont attente des blocs %.3f s),\n",
+            profile_seconds(p, p->mStopTicks - p->mStartTicks), profile_seconds(p, p->mTicks[PHASE_READ_R1]),
+            profile_seconds(p, p->mTicks[PHASE_READ_R2]), profile_seconds(p, p->mTicks[PHASE_IO_WAIT]));
+    fprintf(f, "       construction %.3f s, hash %.3f s, sonde %.3f s, écriture %.3f s, partitions %.3f s\n",
+            profile_seconds(p, p->mTicks[PHASE_BUILD]), profile_seconds(p, p->mTicks[PHASE_HASH]),
+            profile_seconds(p, p->mTicks[PHASE_PROBE]), profile_seconds(p, p->mTicks[PHASE_WRITE]),
+            profile_seconds(p, p->mTicks[PHASE_SPILL]));
+    if (counts->mLookups > 0){
+        size_t compared = 0, i;
+        for (i = 0; i < HTABLE_PROBE_HISTOGRAM; i++)
+            compared += i * counts->mLengths[i];
+        fprintf(f, "       %zu recherche(s) dans la table, %.1f %% trouvée(s), %.2f bucket(s) comparé(s)"
+                " en moyenne\n", counts->mLookups, 100.0 * counts->mHits / counts->mLookups,
+                (double) compared / counts->mLookups);
+    }
+#else
+    (void) f;
+    (void) stats;
+#endif
+}
+
+// fonction pour écrire les statistiques d'un join en JSON
+
+void write_join_json(FILE* f, const JoinStats* stats){
+    fprintf(f, "{\n  \"plan\": \"%s\",\n", stats->mBudget == 0 ? "index" : "hash");
+    fprintf(f, "  \"budget\": %zu,\n  \"batches\": %zu,\n  \"r2_rescans\": %zu,\n", stats->mBudget,
+            stats->mBatches, stats->mPartitions > 0 || stats->mBatches == 0 ? 0 : stats->mBatches - 1);
+    fprintf(f, "  \"rows_r1\": %zu,\n  \"rows_r1_ignored\": %zu,\n  \"rows_r2\": %zu,\n"
+            "  \"rows_r2_matched\": %zu,\n  \"rows_out\": %zu,\n",
+            stats->mRowsR1, stats->mBadKeys, stats->mRowsR2, stats->mMatches, stats->mRowsOut);
+    fprintf(f, "  \"min_buckets\": %zu,\n  \"max_buckets\": %zu,\n  \"peak_bytes\": %zu,\n"
+            "  \"allocated_bytes\": %zu,\n", stats->mMinBuckets, stats->mMaxBuckets, stats->mPeakBytes,
+            stats->mAllocated);
+    fprintf(f, "  \"key_type\": \"%s\",\n  \"dictionary_peak\": %zu,\n",
+            stats->mKeyType == KEY_INT ? "int" : "string", stats->mDictPeak);
+    fprintf(f, "  \"partitions\": %zu,\n  \"heavy_keys\": %zu,\n  \"heavy_rows\": %zu",
+            stats->mPartitions, stats->mHeavyKeys, stats->mHeavyRows);
+#ifndef CSV_JOIN_NO_PROFILE
+    const char* names[PHASE_COUNT] = { "read_r1", "read_r2", "io_wait", "hash", "build", "probe",
+                                       "write", "spill" };
+    const Profile* p = &stats->mProfile;
+    size_t i;
+    fprintf(f, ",\n  \"profile\": {\n    \"seconds\": %.9f,\n    \"ticks\": %" PRIu64 ",\n    \"phases\": {",
+            profile_seconds(p, p->mStopTicks - p->mStartTicks), p->mStopTicks - p->mStartTicks);
+    for (i = 0; i < PHASE_COUNT; i++)
+        fprintf(f, "%s\n      \"%s\": { \"ticks\": %" PRIu64 ", \"seconds\": %.9f }", i > 0 ? "," : "",
+                names[i], p->mTicks[i], profile_seconds(p, p->mTicks[i]));
+    fprintf(f, "\n    },\n    \"lookups\": %zu,\n    \"hits\": %zu,\n    \"probe_lengths\": [",
+            p->mProbes.mLookups, p->mProbes.mHits);
+    for (i = 0; i < HTABLE_PROBE_HISTOGRAM; i++)
+        fprintf(f, "%s%zu", i > 0 ? ", " : "", p->mProbes.mLengths[i]);
+    fprintf(f, "]\n  }");
+#endif
+    fprintf(f, "\n}\n");
+}
+
+// fonction pour écrire les statistiques d'un join en JSON dans le fichier path
+// return 0 si réussit
+
+int dump_join_stats(const char* path, const JoinStats* stats){
+    FILE* f = fopen(path, "w");
+    if (f == NULL){
+        fprintf(stderr, "On ne peut pas écrire les statistiques dans %s\n", path);
+        return -1;
+    }
+    write_join_json(f, stats);
+    if (0 != fclose(f)){
+        fprintf(stderr, "On ne peut pas écrire les statistiques dans %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+/* ======================================================================
+ * Part III -- Persistent hash index
+ * ======================================================================
+ */
+
+// fonction pour charger toutes les lignes (après l'en-tête) d'une relation dans un Htable,
+// sans budget mémoire ; rows est une estimation du nombre de lignes
+// return NULL si on ne peut pas allouer
+
+Htable* load_Htable(RowReader* in, size_t col, KeyCodec* codec, size_t rows, size_t* bad_keys){
+    Htable* table = construct_row_Htable(rows / HASH_TABLE_LOAD_FACTOR + 1);
+    if (table == NULL){
+        fprintf(stderr, "On ne peut pas construire un hash table\n");
+        return NULL;
+    }
+    table->mGrowLimit = SIZE_MAX;   // l'estimation peut être fausse (fichier compressé)
+    int success = 0;
+    csv_row row;
+    while (success == 0 && (row = reader_row(in)) != NULL && strlen(row) > 0){
+        size_t len = 0;
+        const char* field = reader_field(in, row, col, &len);
+        int added = add_row_to_hashtable(table, codec, row, field, len, col, 0, NULL);
+        if (added != 0)
+            free(row);
+        if (added == 1)
+            (*bad_keys)++;
+        else if (added != 0)
+            success = -1;
+    }
+    if (success == 0)
+        free(row);
+    if (codec->mType == KEY_AUTO)    // relation vide : le type n'a pas d'importance
+        codec->mType = KEY_STRING;
+    if (success != 0){
+        fprintf(stderr, "On ne peut pas ajouter une ligne dans hash table\n");
+        delete_Htable_and_content(table);
+        return NULL;
+    }
+    finish_rehash_Htable(table);
+    return table;
+}
+
+// fonction pour écrire n octets de zéros (alignement des sections de l'index)
+// return 0 si réussit
+
+int write_padding(FILE* f, size_t n){
+    static const char zeros[8] = { 0 };
+    return fwrite(zeros, 1, n, f) == n ? 0 : -1;
+}
+
+// fonction qui construit l'index de la colonne col du CSV "in" (de chemin "source")
+// et l'écrit dans "path" ; le CSV est entièrement chargé dans un Htable, puis la table
+// est sérialisée avec des offsets à la place des pointeurs
+// return 0 si réussit
+
+int build_index(RowReader* in, const char* source, size_t col, KeyType type, const char* path){
+    struct stat st;
+    if (0 != stat(source, &st)){
+        perror(source);
+        return -1;
+    }
+
+    csv_row header = reader_row(in);
+    if (header == NULL || strlen(header) == 0){
+        fprintf(stderr, "On ne peut pas lire l'en-tête de \"%s\"\n", source);
+        free(header);
+        return -1;
+    }
+    // estimation du nombre de lignes : des lignes de la largeur de l'en-tête
+    size_t bad_keys = 0;
+    KeyCodec codec;
+    init_KeyCodec(&codec, type);
+    Htable* table = load_Htable(in, col, &codec, (size_t) st.st_size / (strlen(header) + 1) + 1, &bad_keys);
+    if (table == NULL){
+        free(header);
+        clear_Dictionary(&codec.mDict);
+        return -1;
+    }
+    int success = 0;
+
+    // positions des sections, alignées sur 8 octets
+    IndexHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.mMagic, INDEX_MAGIC, sizeof(h.mMagic));
+    h.mSourceSize = (uint64_t) st.st_size;
+    h.mSourceMtime = (int64_t) st.st_mtim.tv_sec;
+    h.mSourceMtimeNsec = (int64_t) st.st_mtim.tv_nsec;
+    h.mColumn = col;
+    h.mKeyType = codec.mType;
+    h.mKeyAuto = codec.mAuto;
+    h.mBucketCount = table->mSize;
+    h.mEntryCount = table->mCount;
+    h.mRowCount = table->mRows;
+    h.mDictCount = codec.mDict.mCount;
+    h.mDictSlotCount = codec.mDict.mSlotCount;
+    h.mBucketsOffset = sizeof(IndexHeader);
+    h.mEntriesOffset = h.mBucketsOffset + h.mBucketCount * sizeof(uint64_t);
+    h.mDictOffset = h.mEntriesOffset + h.mEntryCount * sizeof(IndexEntry);
+    h.mDictSlotsOffset = h.mDictOffset + h.mDictCount * sizeof(uint64_t);
+    h.mHeaderRowOffset = h.mDictSlotsOffset + (h.mDictSlotCount * sizeof(uint32_t) + 7) / 8 * 8;
+
+    FILE* f = success == 0 ? fopen(path, "wb") : NULL;
+    if (f == NULL){
+        if (success == 0)
+            perror(path);
+        success = -1;
+    }
+    if (success == 0){
+        size_t i;
+        uint64_t next = 0, offset;
+        Bucket* bucket;
+
+        // en-tête (réécrit à la fin avec la taille), buckets puis entrées, dans l'ordre des chaînes
+        fwrite(&h, sizeof(h), 1, f);
+        for (i = 0; i < table->mSize; i++){
+            uint64_t first = table->mListOfBucket[i] == NULL ? 0 : next + 1;
+            for (bucket = table->mListOfBucket[i]; bucket != NULL; bucket = bucket->mNext)
+                next++;
+            fwrite(&first, sizeof(first), 1, f);
+        }
+        offset = h.mHeaderRowOffset + strlen(header) + 1;
+        next = 0;
+        const void* const* rows;
+        size_t count, j;
+        for (i = 0; i < table->mSize; i++){
+            for (bucket = table->mListOfBucket[i]; bucket != NULL; bucket = bucket->mNext){
+                next++;
+                count = bucket_rows(bucket, &rows);
+                IndexEntry entry = { bucket->mKey, bucket->mNext == NULL ? 0 : next + 1, offset, count };
+                fwrite(&entry, sizeof(entry), 1, f);
+                for (j = 0; j < count; j++)
+                    offset += strlen(rows[j]) + 1;
+            }
+        }
+        // dictionnaire : les chaînes sont rangées après les lignes
+        for (i = 0; i < codec.mDict.mCount; i++){
+            fwrite(&offset, sizeof(offset), 1, f);
+            offset += strlen(codec.mDict.mStrings[i]) + 1;
+        }
+        if (codec.mDict.mSlotCount > 0)
+            fwrite(codec.mDict.mSlots, sizeof(uint32_t), codec.mDict.mSlotCount, f);
+        write_padding(f, h.mHeaderRowOffset - h.mDictSlotsOffset - h.mDictSlotCount * sizeof(uint32_t));
+
+        fwrite(header, 1, strlen(header) + 1, f);
+        for (i = 0; i < table->mSize; i++)
+            for (bucket = table->mListOfBucket[i]; bucket != NULL; bucket = bucket->mNext)
+                for (j = 0, count = bucket_rows(bucket, &rows); j < count; j++)
+                    fwrite(rows[j], 1, strlen(rows[j]) + 1, f);
+        for (i = 0; i < codec.mDict.mCount; i++)
+            fwrite(codec.mDict.mStrings[i], 1, strlen(codec.mDict.mStrings[i]) + 1, f);
+
+        h.mFileSize = offset;
+        fseek(f, 0, SEEK_SET);
+        fwrite(&h, sizeof(h), 1, f);
+        if (ferror(f)){
+            fprintf(stderr, "Erreur d'écriture de l'index \"%s\"\n", path);
+            success = -1;
+        }
+        if (0 != fclose(f))
+            success = -1;
+    }
+    if (success == 0)
+        fprintf(stderr, "Index \"%s\" : %zu lignes, %zu keys, %zu buckets, keys %s, %zu ligne(s) ignorée(s)\n",
+                path, table->mRows, table->mCount, (size_t) table->mSize,
+                codec.mType == KEY_INT ? "entières" : "chaînes", bad_keys);
+
+    free(header);
+    delete_Htable_and_content(table);
+    clear_Dictionary(&codec.mDict);
+    return success;
+}
+
+// fonction pour vérifier qu'une section de count éléments de size octets, à la position
+// offset, est alignée et tient entre l'en-tête de l'index et ses lignes (sans débordement)
+// return 0 si réussit
+
+int check_index_section(const IndexHeader* h, uint64_t offset, uint64_t count, size_t size){
+    if (offset % 8 != 0 || offset < sizeof(IndexHeader) || offset > h->mHeaderRowOffset)
+        return -1;
+    return count <= (h->mHeaderRowOffset - offset) / size ? 0 : -1;
+}
+
+// fonction pour projeter en mémoire l'index "path" du CSV "source" sur la colonne col
+// l'index doit correspondre à la taille et à la date actuelles du CSV
+// return 0 si réussit, -1 si l'index est absent, invalide ou périmé
+
+int open_index(MappedIndex* index, const char* path, const char* source, size_t col, KeyType type){
+    struct stat st_source, st;
+    if (0 != stat(source, &st_source)){
+        perror(source);
+        return -1;
+    }
+    int fd = open(path, O_RDONLY);
+    if (fd < 0){
+        perror(path);
+        return -1;
+    }
+    if (0 != fstat(fd, &st) || (size_t) st.st_size < sizeof(IndexHeader)){
+        fprintf(stderr, "Index \"%s\" invalide\n", path);
+        close(fd);
+        return -1;
+    }
+    void* base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED){
+        perror(path);
+        return -1;
+    }
+
+    const IndexHeader* h = base;
+    const char* problem = NULL;
+    if (0 != memcmp(h->mMagic, INDEX_MAGIC, sizeof(h->mMagic)) || h->mFileSize != (uint64_t) st.st_size
+        || h->mHeaderRowOffset >= h->mFileSize || ((const char*) base)[h->mFileSize - 1] != '\0'
+        || h->mBucketCount == 0 || 0 != (h->mDictSlotCount & (h->mDictSlotCount - 1))
+        || 0 != check_index_section(h, h->mBucketsOffset, h->mBucketCount, sizeof(uint64_t))
+        || 0 != check_index_section(h, h->mEntriesOffset, h->mEntryCount, sizeof(IndexEntry))
+        || 0 != check_index_section(h, h->mDictOffset, h->mDictCount, sizeof(uint64_t))
+        || 0 != check_index_section(h, h->mDictSlotsOffset, h->mDictSlotCount, sizeof(uint32_t)))
+        problem = "invalide";
+    else if (h->mSourceSize != (uint64_t) st_source.st_size || h->mSourceMtime != (int64_t) st_source.st_mtim.tv_sec
+             || h->mSourceMtimeNsec != (int64_t) st_source.st_mtim.tv_nsec)
+        problem = "périmé";
+    else if (h->mColumn != col)
+        problem = "construit sur une autre colonne";
+    else if (type != KEY_AUTO && type != (KeyType) h->mKeyType)
+        problem = "construit avec un autre type de key";
+
+    if (problem != NULL){
+        fprintf(stderr, "Index \"%s\" %s pour \"%s\"\n", path, problem, source);
+        munmap(base, st.st_size);
+        return -1;
+    }
+    index->mBase = base;
+    index->mSize = st.st_size;
+    index->mHeader = h;
+    return 0;
+}
+
+// fonction pour libérer la projection d'un index
+
+void close_index(MappedIndex* index){
+    munmap((void*) index->mBase, index->mSize);
+    index->mBase = NULL;
+    index->mHeader = NULL;
+}
+
+// fonction pour encoder une key de R2 comme les keys de l'index (cf. encode_probe_key)
+// return 0 si réussit, 1 si la key ne peut correspondre à aucune ligne de l'index
+
+int encode_index_key(const MappedIndex* index, const char* s, size_t len, key_word* key){
+    const IndexHeader* h = index->mHeader;
+    int64_t value;
+    if (h->mKeyType == KEY_INT){
+        if (0 != parse_int_key(s, len, h->mKeyAuto, &value))
+            return 1;
+        *key = (key_word) value;
+        return 0;
+    }
+    if (len <= KEY_INLINE_MAX){
+        *key = inline_key(s, len);
+        return 0;
+    }
+    if (h->mDictSlotCount == 0)
+        return 1;
+
+    const uint32_t* slots = (const uint32_t*) (index->mBase + h->mDictSlotsOffset);
+    const uint64_t* strings = (const uint64_t*) (index->mBase + h->mDictOffset);
+    size_t mask = h->mDictSlotCount - 1;
+    size_t i = hash_bytes(s, len) & mask;
+    while (slots[i] != 0 && slots[i] <= h->mDictCount && strings[slots[i] - 1] < h->mFileSize){
+        const char* other = index->mBase + strings[slots[i] - 1];
+        if (0 == strncmp(other, s, len) && other[len] == '\0'){
+            *key = slots[i] - 1;
+            return 0;
+        }
+        i = (i + 1) & mask;
+    }
+    return 1;
+}
+
+// fonction pour récupérer les lignes de l'index à partir d'un key : *count lignes
+// rangées à la suite, chacune terminée par '\0'
+// return NULL si le key n'existe pas
+
+const char* get_index_value(const MappedIndex* index, key_word key, size_t* count){
+    const IndexHeader* h = index->mHeader;
+    const uint64_t* buckets = (const uint64_t*) (index->mBase + h->mBucketsOffset);
+    const IndexEntry* entries = (const IndexEntry*) (index->mBase + h->mEntriesOffset);
+    uint64_t i = buckets[hash_word(key, h->mBucketCount)];
+    for (; i != 0 && i <= h->mEntryCount; i = entries[i - 1].mNext){  // liens vérifiés : index non sûr
+        if (entries[i - 1].mKey == key){
+            if (entries[i - 1].mRow < h->mHeaderRowOffset || entries[i - 1].mRow >= h->mFileSize)
+                return NULL;
+            *count = entries[i - 1].mRowCount;
+            return index->mBase + entries[i - 1].mRow;
+        }
+    }
+    return NULL;
+}
+
+// fonction pour faire le join de R2 avec un index : un seul scan de R2, sans construction
+// (le semi-join et l'anti-join n'ont besoin que de savoir si la key est dans l'index ;
+// le group-join, qui met à jour les lignes de R1, passe par hash_join)
+// return 0 si réussit
+
+int index_join(const MappedIndex* index, RowReader* in, FILE* out, size_t col, const JoinOptions* options){
+    Pipeline* pipeline = options->mPipeline;
+    JoinStats stats;
+    init_JoinStats(&stats, 0);
+    stats.mBatches = 1;
+    stats.mRowsR1 = index->mHeader->mRowCount;
+    stats.mMinBuckets = stats.mMaxBuckets = index->mHeader->mBucketCount;
+    stats.mPeakBytes = index->mSize;
+    stats.mKeyType = (KeyType) index->mHeader->mKeyType;
+    stats.mDictPeak = index->mHeader->mDictCount;
+
+    csv_row header = reader_row(in);
+    if (header == NULL){
+        fprintf(stderr, "On ne peut pas lire l'en-tête\n");
+        return -1;
+    }
+    if (0 != check_pipeline(pipeline, index->mBase + index->mHeader->mHeaderRowOffset, header, col)){
+        free(header);
+        return -1;
+    }
+    emit_header(out, options, index->mBase + index->mHeader->mHeaderRowOffset, header, col);
+    free(header);
+
+    csv_row row;
+    ProbeField field;
+    while(next_probe_row(in, col, &row, &field)){
+        stats.mRowsR2++;
+        size_t len = 0;
+        key_word key;
+        uint64_t ticks = PROFILE_TICKS();
+        const char* text = NULL;
+        size_t count = 0, i;
+        const char* value = NULL;
+        int found;
+        if (field.mIsInt && index->mHeader->mKeyType == KEY_INT){
+            key = (key_word) field.mValue;     // la colonne d'entiers du cache donne la key
+            found = 1;
+        } else {
+            text = probe_field_text(&field, &len);
+            found = (text != NULL && 0 == encode_index_key(index, text, len, &key));
+        }
+        if (found){
+            PROFILE_LAP(&stats, PHASE_HASH, ticks);
+            value = get_index_value(index, key, &count);
+            PROFILE_LAP(&stats, PHASE_PROBE, ticks);
+        }
+        if (value != NULL)
+            stats.mMatches++;
+        if (row == NULL && (value != NULL) != (options->mMode == JOIN_ANTI)
+            && (row = columns_current_row(in)) == NULL)
+            break;
+        if (row != NULL && (options->mMode == JOIN_SEMI || options->mMode == JOIN_ANTI))
+            stats.mRowsOut += filter_row(out, options->mMode, value != NULL, row, NULL, 0, 1);
+        else if (row != NULL)
+            for (i = 0; i < count && value < index->mBase + index->mSize; i++, value += strlen(value) + 1)
+                stats.mRowsOut += emit_rows(out, pipeline, value, row, col, 0);
+        free(row);
+        PROFILE_LAP(&stats, PHASE_WRITE, ticks);
+    }
+    stop_JoinStats(&stats, NULL, in);
+    print_join_stats(stderr, &stats);
+    if (options->mStatsPath != NULL && 0 != dump_join_stats(options->mStatsPath, &stats))
+        return -1;
+    return 0;
+}
+
+/* ======================================================================
+ * Part IV -- Row readers and columnar sidecar cache
+ * ======================================================================
+ */
+
+// fonction qui construit le chemin du cache colonnes d'un CSV
+
+void sidecar_path(const char* source, char path[]){
+    snprintf(path, FILENAME_MAX + 1, "%s%s", source, COLUMNS_SUFFIX);
+}
+
+// fonction pour passer une colonne d'entiers en chaînes : les entiers étant canoniques,
+// les réécrire redonne exactement le texte du CSV
+// return 0 si réussit
+
+int column_to_strings(ColumnBuilder* column, size_t rows, size_t capacity){
+    column->mCodes = malloc(capacity * sizeof(uint32_t));
+    if (column->mCodes == NULL)
+        return -1;
+    size_t i;
+    for (i = 0; i < rows; i++){
+        char text[24];
+        int len = snprintf(text, sizeof(text), "%" PRId64, column->mValues[i]);
+        if (0 != intern_Dictionary(&column->mDict, text, len, &column->mCodes[i]))
+            return -1;
+    }
+    free(column->mValues);
+    column->mValues = NULL;
+    return 0;
+}
+
+// fonction qui retourne le nombre d'octets (1, 2, 4 ou 8) des entiers signés de min à max
+
+uint32_t int_width(int64_t min, int64_t max){
+    if (min >= INT8_MIN && max <= INT8_MAX)
+        return 1;
+    if (min >= INT16_MIN && max <= INT16_MAX)
+        return 2;
+    if (min >= INT32_MIN && max <= INT32_MAX)
+        return 4;
+    return 8;
+}
+
+// fonction pour écrire les width octets de poids faible de value (entier ou position
+// du cache colonnes), dans l'ordre de la machine comme le reste du cache
+
+void write_word(FILE* f, uint64_t value, uint32_t width){
+    uint8_t byte = (uint8_t) value;
+    uint16_t half = (uint16_t) value;
+    uint32_t word = (uint32_t) value;
+    switch (width){
+    case 1: fwrite(&byte, 1, 1, f); break;
+    case 2: fwrite(&half, 2, 1, f); break;
+    case 4: fwrite(&word, 4, 1, f); break;
+    default: fwrite(&value, 8, 1, f);
+    }
+}
+
+// fonction qui retourne la mémoire des count colonnes en construction, pour capacity lignes
+
+size_t sidecar_footprint(const ColumnBuilder* columns, size_t count, size_t capacity){
+    size_t bytes = ALLOC_SIZE(count * sizeof(ColumnBuilder)), j;
+    for (j = 0; j < count; j++)
+        bytes += ALLOC_SIZE(capacity * (columns[j].mCodes != NULL ? sizeof(uint32_t) : sizeof(int64_t)))
+                 + columns[j].mDict.mBytes;
+    return bytes;
+}
+
+// fonction qui écrit le cache colonnes du CSV "source" ; le CSV est lu entièrement
+// en mémoire, colonne par colonne, dans au plus budget octets (SIZE_MAX : sans limite)
+// return 0 si réussit, -1 si on ne peut pas lire ou écrire, si les lignes n'ont
+// pas toutes le nombre de colonnes de l'en-tête ou si les colonnes dépassent le budget
+
+int write_sidecar(const char* source, size_t budget){
+    struct stat st;
+    FILE* in = fopen(source, "r");
+    if (in == NULL || 0 != fstat(fileno(in), &st)){
+        perror(source);
+        if (in != NULL) fclose(in);
+        return -1;
+    }
+    RowReader reader;       // le CSV peut être compressé
+    open_reader(&reader, in, NULL, IO_MAX_BLOCK, 0);
+    csv_row header = reader_row(&reader);
+    if (header == NULL || strlen(header) == 0){
+        fprintf(stderr, "On ne peut pas lire l'en-tête de \"%s\"\n", source);
+        free(header);
+        close_reader(&reader);
+        fclose(in);
+        return -1;
+    }
+    size_t count = 1;
+    const char* c;
+    for (c = header; *c != '\0'; c++)
+        if (*c == CSV_SEPARATOR) count++;
+
+    ColumnBuilder* columns = calloc(count, sizeof(ColumnBuilder));
+    if (columns == NULL){
+        free(header);
+        close_reader(&reader);
+        fclose(in);
+        return -1;
+    }
+    size_t j;
+    for (j = 0; j < count; j++)
+        init_Dictionary(&columns[j].mDict);
+
+    int success = 0;
+    size_t rows = 0, capacity = 0;
+    csv_row row;
+    while (success == 0 && (row = reader_row(&reader)) != NULL && strlen(row) > 0){
+        if (rows == capacity){     // agrandir toutes les colonnes
+            capacity = capacity == 0 ? 1024 : 2 * capacity;
+            if (reader_footprint(&reader) + sidecar_footprint(columns, count, capacity) > budget)
+                success = 1;
+            for (j = 0; j < count && success == 0; j++){
+                void** array = columns[j].mCodes != NULL ? (void**) &columns[j].mCodes : (void**) &columns[j].mValues;
+                size_t size = columns[j].mCodes != NULL ? sizeof(uint32_t) : sizeof(int64_t);
+                void* grown = realloc(*array, capacity * size);
+                if (grown == NULL)
+                    success = -1;
+                else
+                    *array = grown;
+            }
+        }
+        const char* field = row;
+        for (j = 0; j < count && success == 0; j++){
+            size_t len = 0;
+            field = row_field(field, 0, &len);
+            ColumnBuilder* column = &columns[j];
+            int64_t value;
+            if (column->mCodes == NULL && 0 == parse_int_key(field, len, 1, &value))
+                column->mValues[rows] = value;
+            else if ((column->mCodes == NULL && 0 != column_to_strings(column, rows, capacity))
+                     || 0 != intern_Dictionary(&column->mDict, field, len, &column->mCodes[rows]))
+                success = -1;
+            field += len;
+            if (j + 1 < count && *field++ != CSV_SEPARATOR){
+                fprintf(stderr, "Ligne %zu de \"%s\" : moins de %zu colonnes, pas de cache\n", rows + 2, source, count);
+                success = -1;
+            }
+        }
+        if (success == 0 && *field != '\0'){
+            fprintf(stderr, "Ligne %zu de \"%s\" : plus de %zu colonnes, pas de cache\n", rows + 2, source, count);
+            success = -1;
+        }
+        if (success == 0 && reader_footprint(&reader) + sidecar_footprint(columns, count, capacity) > budget)
+            success = 1;    // les dictionnaires ont grandi
+        free(row);
+        rows++;
+    }
+    if (success == 0)
+        free(row);
+    if (success == 1){
+        fprintf(stderr, "Cache colonnes de \"%s\" : plus de %zu octets en mémoire, pas de cache\n",
+                source, budget);
+        success = -1;
+    }
+    if (0 != close_reader(&reader) && success == 0){
+        fprintf(stderr, "Erreur de lecture de \"%s\", pas de cache\n", source);
+        success = -1;
+    }
+    fclose(in);
+
+    ColumnsHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.mMagic, COLUMNS_MAGIC, sizeof(h.mMagic));
+    h.mSourceSize = (uint64_t) st.st_size;
+    h.mSourceMtime = (int64_t) st.st_mtim.tv_sec;
+    h.mSourceMtimeNsec = (int64_t) st.st_mtim.tv_nsec;
+    h.mRowCount = rows;
+    h.mColumnCount = count;
+    h.mColumnsOffset = sizeof(ColumnsHeader);
+    h.mHeaderRowOffset = h.mColumnsOffset + count * sizeof(ColumnHeader);
+
+    char path[FILENAME_MAX + 1];
+    sidecar_path(source, path);
+    FILE* f = success == 0 ? fopen(path, "wb") : NULL;
+    if (success == 0 && f == NULL){
+        perror(path);
+        success = -1;
+    }
+    if (success == 0){
+        // format de chaque colonne et positions des sections, alignées sur 8 octets
+        ColumnHeader* descriptions = calloc(count, sizeof(ColumnHeader));
+        uint64_t offset = (h.mHeaderRowOffset + strlen(header) + 1 + 7) / 8 * 8;
+        size_t i, k;
+        for (j = 0; descriptions != NULL && j < count; j++){
+            const ColumnBuilder* column = &columns[j];
+            ColumnHeader* description = &descriptions[j];
+            description->mValuesOffset = offset;
+            if (column->mCodes == NULL){
+                int64_t min = 0, max = 0;
+                for (i = 0; i < rows; i++){
+                    if (column->mValues[i] < min) min = column->mValues[i];
+                    if (column->mValues[i] > max) max = column->mValues[i];
+                }
+                description->mType = COLUMN_INT;
+                description->mWidth = int_width(min, max);
+                offset += (rows * description->mWidth + 7) / 8 * 8;
+                continue;
+            }
+            // le dictionnaire ne vaut que si les valeurs se répètent assez
+            uint64_t dict_bytes = 0, raw_bytes = 0;
+            for (k = 0; k < column->mDict.mCount; k++)
+                dict_bytes += strlen(column->mDict.mStrings[k]);
+            for (i = 0; i < rows; i++)
+                raw_bytes += strlen(column->mDict.mStrings[column->mCodes[i]]);
+            uint32_t width = raw_bytes <= UINT32_MAX ? 4 : 8;
+            uint64_t dict_size = (rows * sizeof(uint32_t) + 7) / 8 * 8
+                                 + (column->mDict.mCount + 1) * sizeof(uint64_t) + dict_bytes;
+            if (dict_size < (rows + 1) * width + raw_bytes){
+                description->mType = COLUMN_DICT;
+                offset += (rows * sizeof(uint32_t) + 7) / 8 * 8;
+                description->mDictCount = column->mDict.mCount;
+                description->mDictOffsetsOffset = offset;
+                offset += (column->mDict.mCount + 1) * sizeof(uint64_t);
+                description->mBytesOffset = offset;
+                offset = (offset + dict_bytes + 7) / 8 * 8;
+            } else {
+                description->mType = COLUMN_RAW;
+                description->mWidth = width;
+                offset += ((rows + 1) * width + 7) / 8 * 8;
+                description->mBytesOffset = offset;
+                offset = (offset + raw_bytes + 7) / 8 * 8;
+            }
+        }
+        h.mFileSize = offset;
+
+        if (descriptions == NULL){
+            success = -1;
+        } else {
+            fwrite(&h, sizeof(h), 1, f);
+            fwrite(descriptions, sizeof(ColumnHeader), count, f);
+            fwrite(header, 1, strlen(header) + 1, f);
+            write_padding(f, descriptions[0].mValuesOffset - h.mHeaderRowOffset - strlen(header) - 1);
+            for (j = 0; j < count; j++){
+                const ColumnBuilder* column = &columns[j];
+                const ColumnHeader* description = &descriptions[j];
+                uint64_t start = 0;
+                switch (description->mType){
+                case COLUMN_INT:
+                    for (i = 0; i < rows; i++)
+                        write_word(f, (uint64_t) column->mValues[i], description->mWidth);
+                    write_padding(f, (8 - rows * description->mWidth % 8) % 8);
+                    break;
+                case COLUMN_DICT:
+                    if (rows > 0)
+                        fwrite(column->mCodes, sizeof(uint32_t), rows, f);
+                    write_padding(f, (rows * sizeof(uint32_t)) % 8);
+                    for (k = 0; k <= column->mDict.mCount; k++){
+                        fwrite(&start, sizeof(start), 1, f);
+                        if (k < column->mDict.mCount)
+                            start += strlen(column->mDict.mStrings[k]);
+                    }
+                    for (k = 0; k < column->mDict.mCount; k++)
+                        fwrite(column->mDict.mStrings[k], 1, strlen(column->mDict.mStrings[k]), f);
+                    write_padding(f, (8 - start % 8) % 8);
+                    break;
+                default:
+                    for (i = 0; i <= rows; i++){
+                        write_word(f, start, description->mWidth);
+                        if (i < rows)
+                            start += strlen(column->mDict.mStrings[column->mCodes[i]]);
+                    }
+                    write_padding(f, (8 - (rows + 1) * description->mWidth % 8) % 8);
+                    for (i = 0; i < rows; i++){
+                        const char* text = column->mDict.mStrings[column->mCodes[i]];
+                        fwrite(text, 1, strlen(text), f);
+                    }
+                    write_padding(f, (8 - start % 8) % 8);
+                }
+            }
+            if (ferror(f)){
+                fprintf(stderr, "Erreur d'écriture du cache \"%s\"\n", path);
+                success = -1;
+            }
+        }
+        free(descriptions);
+        if (0 != fclose(f))
+            success = -1;
+        if (success != 0)
+            remove(path);
+    }
+
+    for (j = 0; j < count; j++){
+        free(columns[j].mValues);
+        free(columns[j].mCodes);
+        clear_Dictionary(&columns[j].mDict);
+    }
+    free(columns);
+    free(header);
+    return success;
+}
+
+// fonction pour vérifier qu'une section de count éléments de size octets, à la position
+// offset, est alignée et tient dans le cache entre l'en-tête du CSV et la fin du fichier
+// return 0 si oui
+
+int check_column_section(const ColumnsHeader* h, uint64_t offset, uint64_t count, size_t size){
+    if (offset % 8 != 0 || offset <= h->mHeaderRowOffset || offset > h->mFileSize)
+        return -1;
+    return count <= (h->mFileSize - offset) / size ? 0 : -1;
+}
+
+// fonction pour vérifier les sections d'une colonne du cache projeté en base, et que
+// ses dernières positions (fin des chaînes) restent dans le fichier
+// return 0 si elle est valide
+
+int check_column(const char* base, const ColumnsHeader* h, const ColumnHeader* column){
+    uint64_t bytes;
+    switch (column->mType){
+    case COLUMN_INT:
+        if (column->mWidth != 1 && column->mWidth != 2 && column->mWidth != 4 && column->mWidth != 8)
+            return -1;
+        return check_column_section(h, column->mValuesOffset, h->mRowCount, column->mWidth);
+    case COLUMN_DICT:
+        if (column->mDictCount == UINT64_MAX
+            || 0 != check_column_section(h, column->mValuesOffset, h->mRowCount, sizeof(uint32_t))
+            || 0 != check_column_section(h, column->mDictOffsetsOffset, column->mDictCount + 1, sizeof(uint64_t)))
+            return -1;
+        bytes = ((const uint64_t*) (base + column->mDictOffsetsOffset))[column->mDictCount];
+        return check_column_section(h, column->mBytesOffset, bytes, 1);
+    case COLUMN_RAW:
+        if ((column->mWidth != 4 && column->mWidth != 8) || h->mRowCount == UINT64_MAX
+            || 0 != check_column_section(h, column->mValuesOffset, h->mRowCount + 1, column->mWidth))
+            return -1;
+        if (column->mWidth == 4)
+            bytes = ((const uint32_t*) (base + column->mValuesOffset))[h->mRowCount];
+        else
+            bytes = ((const uint64_t*) (base + column->mValuesOffset))[h->mRowCount];
+        return check_column_section(h, column->mBytesOffset, bytes, 1);
+    default:
+        return -1;
+    }
+}
+
+// fonction pour projeter en mémoire le cache colonnes de "source"
+// return 0 si réussit, -1 si le cache est absent, invalide ou périmé (sans message)
+
+int map_sidecar(MappedColumns* columns, const char* source){
+    char path[FILENAME_MAX + 1];
+    struct stat st_source, st;
+    sidecar_path(source, path);
+    if (0 != stat(source, &st_source))
+        return -1;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    if (0 != fstat(fd, &st) || (size_t) st.st_size < sizeof(ColumnsHeader)){
+        close(fd);
+        return -1;
+    }
+    void* base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return -1;
+
+    const ColumnsHeader* h = base;
+    int valid = 0 == memcmp(h->mMagic, COLUMNS_MAGIC, sizeof(h->mMagic)) && h->mFileSize == (uint64_t) st.st_size
+                && h->mSourceSize == (uint64_t) st_source.st_size
+                && h->mSourceMtime == (int64_t) st_source.st_mtim.tv_sec
+                && h->mSourceMtimeNsec == (int64_t) st_source.st_mtim.tv_nsec
+                && h->mColumnsOffset == sizeof(ColumnsHeader) && h->mColumnCount > 0
+                && h->mHeaderRowOffset >= h->mColumnsOffset && h->mHeaderRowOffset < h->mFileSize
+                && h->mColumnCount <= (h->mHeaderRowOffset - h->mColumnsOffset) / sizeof(ColumnHeader)
+                && NULL != memchr((const char*) base + h->mHeaderRowOffset, '\0', h->mFileSize - h->mHeaderRowOffset);
+    columns->mColumns = (const ColumnHeader*) ((const char*) base + h->mColumnsOffset);
+    size_t j;
+    for (j = 0; valid && j < h->mColumnCount; j++)
+        valid = (0 == check_column(base, h, &columns->mColumns[j]));
+    if (!valid){
+        munmap(base, st.st_size);
+        return -1;
+    }
+    columns->mBase = base;
+    columns->mSize = st.st_size;
+    columns->mHeader = h;
+    return 0;
+}
+
+// fonction pour préparer la lecture d'une relation : depuis le cache colonnes de
+// "source" s'il est à jour, depuis le CSV "f" sinon (source peut être NULL) ;
+// le CSV est lu par blocs de "block" octets, par un thread si threads, et décompressé
+// s'il est au format gzip ; sans thread, un CSV qu'on peut relire passe par stdio
+
+void open_reader(RowReader* reader, FILE* f, const char* source, size_t block, int threads){
+    reader->mFile = f;
+    reader->mAhead = NULL;
+    reader->mColumns.mBase = NULL;
+    reader->mRow = 0;
+    reader->mSpillLevel = 0;
+    reader->mFailed = 0;
+    reader->mFieldStart = NULL;
+    reader->mFieldLen = NULL;
+#ifndef CSV_JOIN_NO_PROFILE
+    reader->mTicks = 0;
+#endif
+    reader->mSeekable = (f != NULL && -1 != lseek(fileno(f), 0, SEEK_CUR));
+    if (source != NULL && 0 == map_sidecar(&reader->mColumns, source)){
+        reader->mSeekable = 1;
+        size_t count = reader->mColumns.mHeader->mColumnCount;
+        reader->mFieldStart = calloc(count, sizeof(size_t));
+        reader->mFieldLen = calloc(count, sizeof(size_t));
+        if (reader->mFieldStart != NULL && reader->mFieldLen != NULL)
+            return;
+        close_reader(reader);   // on lit le CSV
+    }
+    if (f == NULL || block == 0)
+        return;
+    if (!threads && reader->mSeekable){
+        unsigned char magic[2];
+        ssize_t n = pread(fileno(f), magic, sizeof(magic), ftello(f));
+        if (n < 0 || INPUT_PLAIN == detect_format(magic, n, block))
+            return;
+    }
+    if ((reader->mAhead = malloc(sizeof(ReadAhead))) == NULL)
+        return;
+    // rien n'a encore été lu par stdio : la lecture par blocs reprend à la position du FILE*
+    if ((reader->mSeekable && -1 == lseek(fileno(f), ftello(f), SEEK_SET))
+        || 0 != start_read_ahead(reader->mAhead, fileno(f), block, threads)){
+        free(reader->mAhead);   // on lit par stdio
+        reader->mAhead = NULL;
+        if (reader->mSeekable)
+            lseek(fileno(f), ftello(f), SEEK_SET);
+    }
+}
+
+// fonction qui retourne la mémoire des tampons de lecture d'un lecteur
+
+size_t reader_footprint(const RowReader* reader){
+    const ReadAhead* ahead = reader->mAhead;
+    if (ahead == NULL)
+        return BUFSIZ;
+    size_t bytes = ALLOC_SIZE(sizeof(ReadAhead)) + 2 * ALLOC_SIZE(ahead->mBlockSize);
+    if (ahead->mFormat == INPUT_GZIP)
+        bytes += ALLOC_SIZE(ahead->mRawSize) + INFLATE_MEMORY;
+    else if (ahead->mFormat == INPUT_BGZF)
+        bytes += ALLOC_SIZE(ahead->mRawSize) + ALLOC_SIZE(ahead->mMemberCapacity * sizeof(BgzfMember))
+                 + (ahead->mWorkers + 1) * INFLATE_MEMORY;
+    return bytes;
+}
+
+// fonction pour lire la ligne suivante (l'en-tête d'abord), comme read_row
+// return la ligne allouée, "" à la fin, NULL si on ne peut pas allouer
+
+csv_row reader_row(RowReader* reader){
+    uint64_t start = PROFILE_TICKS();
+    csv_row row;
+    if (reader->mColumns.mBase != NULL)
+        row = columns_row(reader);
+    else
+        row = reader->mAhead != NULL ? read_ahead_row(reader->mAhead) : read_row(reader->mFile);
+    PROFILE_ADD(reader->mTicks, start);
+    return row;
+}
+
+// fonction pour reconstruire la ligne suivante depuis le cache colonnes, comme reader_row
+// return la ligne allouée, "" à la fin, NULL si on ne peut pas allouer ou si le cache
+//        est incohérent
+
+csv_row columns_row(RowReader* reader){
+    const ColumnsHeader* h = reader->mColumns.mHeader;
+    if (reader->mRow == 0){
+        const char* header = reader->mColumns.mBase + h->mHeaderRowOffset;
+        csv_row row = malloc(strlen(header) + 1);
+        reader->mRow++;
+        if (row != NULL)
+            memcpy(row, header, strlen(header) + 1);
+        return row;
+    }
+    if (reader->mRow > h->mRowCount)
+        return calloc(1, sizeof(char));
+    reader->mRow++;
+    return columns_current_row(reader);
+}
+
+// fonction pour reconstruire depuis le cache colonnes la dernière ligne lue (par
+// columns_row ou next_probe_row), et noter où commence chacun de ses champs
+// return la ligne allouée, NULL si on ne peut pas allouer ou si le cache est incohérent
+
+csv_row columns_current_row(RowReader* reader){
+    const MappedColumns* columns = &reader->mColumns;
+    const ColumnsHeader* h = columns->mHeader;
+    char line[CSV_MAX_LINE_SIZE + 1];
+    size_t len = 0, i = reader->mRow - 2, j;
+
+    for (j = 0; j < h->mColumnCount; j++){
+        const ColumnHeader* column = &columns->mColumns[j];
+        char digits[24];
+        const char* text = digits;
+        size_t n;
+        if (column->mType == COLUMN_INT)
+            n = format_int(column_int(columns, column, i), digits);
+        else
+            text = column_text(columns, column, i, &n);
+        // le CSV n'avait pas de lignes aussi longues
+        if (text == NULL || len + 1 + n >= CSV_MAX_LINE_SIZE){
+            reader->mFailed = 1;
+            return NULL;
+        }
+        if (j > 0)
+            line[len++] = CSV_SEPARATOR;
+        reader->mFieldStart[j] = len;
+        memcpy(line + len, text, n);
+        len += n;
+        reader->mFieldLen[j] = n;
+    }
+
+    csv_row row;
+    if ((row = calloc(len + 1, sizeof(char))) == NULL) {
+        reader->mFailed = 1;
+        return NULL;
+    }
+    memcpy(row, line, len);
+    return row;
+}
+
+// fonction qui lit l'entier de la ligne i dans une colonne COLUMN_INT du cache
+
+int64_t column_int(const MappedColumns* columns, const ColumnHeader* column, size_t i){
+    const char* values = columns->mBase + column->mValuesOffset;
+    switch (column->mWidth){
+    case 1: return ((const int8_t*) values)[i];
+    case 2: return ((const int16_t*) values)[i];
+    case 4: return ((const int32_t*) values)[i];
+    default: return ((const int64_t*) values)[i];
+    }
+}
+
+// fonction pour écrire un entier en décimal (sans '\0') dans digits, de 20 octets au
+// moins, comme "%" PRId64 mais sans passer par snprintf à chaque champ du cache
+// return le nombre de caractères écrits
+
+size_t format_int(int64_t value, char digits[]){
+    char reversed[20];
+    uint64_t magnitude = value < 0 ? 0 - (uint64_t) value : (uint64_t) value;
+    size_t n = 0, len = 0;
+    do {
+        reversed[n++] = (char) ('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+    if (value < 0)
+        digits[len++] = '-';
+    while (n > 0)
+        digits[len++] = reversed[--n];
+    return len;
+}
+
+// fonction qui localise la chaîne de la ligne i dans une colonne COLUMN_DICT ou
+// COLUMN_RAW du cache (map_sidecar a vérifié que la dernière position tient dans le fichier)
+// return la chaîne, qui n'est pas terminée par '\0', NULL si le cache est incohérent
+
+const char* column_text(const MappedColumns* columns, const ColumnHeader* column, size_t i, size_t* len){
+    const char* values = columns->mBase + column->mValuesOffset;
+    uint64_t start, end, last;
+    if (column->mType == COLUMN_DICT){
+        const uint64_t* offsets = (const uint64_t*) (columns->mBase + column->mDictOffsetsOffset);
+        uint32_t code = ((const uint32_t*) values)[i];
+        if (code >= column->mDictCount)
+            return NULL;
+        start = offsets[code];
+        end = offsets[code + 1];
+        last = offsets[column->mDictCount];
+    } else if (column->mWidth == 4){
+        start = ((const uint32_t*) values)[i];
+        end = ((const uint32_t*) values)[i + 1];
+        last = ((const uint32_t*) values)[columns->mHeader->mRowCount];
+    } else {
+        start = ((const uint64_t*) values)[i];
+        end = ((const uint64_t*) values)[i + 1];
+        last = ((const uint64_t*) values)[columns->mHeader->mRowCount];
+    }
+    if (start > end || end > last)
+        return NULL;
+    *len = end - start;
+    return columns->mBase + column->mBytesOffset + start;
+}
+
+// fonction pour lire la ligne suivante de R2 et sa key (colonne col) ; depuis le cache
+// colonnes, seule la key est lue : la ligne n'est reconstruite, par columns_current_row,
+// que si le join l'écrit (*row reste alors NULL)
+// return 1 si une ligne a été lue, 0 à la fin (ou si on ne peut pas lire)
+
+int next_probe_row(RowReader* reader, size_t col, csv_row* row, ProbeField* field){
+    const MappedColumns* columns = &reader->mColumns;
+    field->mIsInt = 0;
+    field->mText = NULL;
+    field->mLen = 0;
+    if (columns->mBase == NULL || reader->mRow == 0){
+        *row = reader_row(reader);
+        if (*row == NULL || strlen(*row) == 0){
+            free(*row);
+            *row = NULL;
+            return 0;
+        }
+        field->mText = reader_field(reader, *row, col, &field->mLen);
+        return 1;
+    }
+
+    uint64_t start = PROFILE_TICKS();
+    *row = NULL;
+    if (reader->mRow > columns->mHeader->mRowCount)
+        return 0;
+    size_t i = reader->mRow++ - 1;
+    if (col < columns->mHeader->mColumnCount){
+        const ColumnHeader* column = &columns->mColumns[col];
+        if (column->mType == COLUMN_INT){
+            field->mIsInt = 1;
+            field->mValue = column_int(columns, column, i);
+        } else if ((field->mText = column_text(columns, column, i, &field->mLen)) == NULL){
+            reader->mFailed = 1;
+            return 0;
+        }
+    }
+    PROFILE_ADD(reader->mTicks, start);
+    return 1;
+}
+
+// fonction qui retourne le texte de la key lue par next_probe_row
+// return NULL si la ligne n'a pas ce champ
+
+const char* probe_field_text(ProbeField* field, size_t* len){
+    if (field->mIsInt){
+        *len = format_int(field->mValue, field->mDigits);
+        return field->mDigits;
+    }
+    *len = field->mLen;
+    return field->mText;
+}
+
+// fonction qui localise le champ col de la dernière ligne lue par reader_row
+// (sans découper la ligne quand elle vient du cache colonnes)
+// return NULL si la ligne n'a pas de colonne col
+
+const char* reader_field(const RowReader* reader, csv_const_row row, size_t col, size_t* len){
+    if (reader->mColumns.mBase == NULL || reader->mRow < 2)
+        return row_field(row, col, len);
+    if (col >= reader->mColumns.mHeader->mColumnCount)
+        return NULL;
+    *len = reader->mFieldLen[col];
+    return row + reader->mFieldStart[col];
+}
+
+// fonction pour revenir au début de la relation (à l'en-tête)
+// return 0 si réussit
+
+int rewind_reader(RowReader* reader){
+    reader->mRow = 0;
+    if (reader->mColumns.mBase != NULL)
+        return 0;
+    if (reader->mAhead != NULL)
+        return restart_read_ahead(reader->mAhead);
+    return fseek(reader->mFile, 0, SEEK_SET);
+}
+
+// fonction pour libérer le cache colonnes et le thread de lecture d'un lecteur
+// (le FILE* reste ouvert)
+// return 0 si réussit, -1 si la lecture a échoué (les lignes lues sont incomplètes)
+
+int close_reader(RowReader* reader){
+    int success = reader->mFailed ? -1 : 0;
+    if (reader->mAhead != NULL){
+        delete_read_ahead(reader->mAhead);
+        if (reader->mAhead->mFailed)
+            success = -1;
+    }
+    free(reader->mAhead);
+    reader->mAhead = NULL;
+    if (reader->mColumns.mBase != NULL)
+        munmap((void*) reader->mColumns.mBase, reader->mColumns.mSize);
+    reader->mColumns.mBase = NULL;
+    free(reader->mFieldStart);
+    free(reader->mFieldLen);
+    reader->mFieldStart = NULL;
+    reader->mFieldLen = NULL;
+    return success;
+}
+
+/* ======================================================================
+ * Part V -- Multi-way join pipeline
+ * ======================================================================
+ */
+
+// fonction pour ajouter un champ à la fin d'un tuple
+// return 0 si réussit
+
+int push_field(Tuple* tuple, const char* start, size_t len){
+    if (tuple->mCount == tuple->mCapacity){
+        size_t capacity = tuple->mCapacity == 0 ? 16 : 2 * tuple->mCapacity;
+        TupleField* fields = realloc(tuple->mFields, capacity * sizeof(TupleField));
+        if (fields == NULL)
+            return -1;
+        tuple->mFields = fields;
+        tuple->mCapacity = capacity;
+    }
+    tuple->mFields[tuple->mCount].mStart = start;
+    tuple->mFields[tuple->mCount].mLen = len;
+    tuple->mCount++;
+    return 0;
+}
+
+// fonction pour ajouter au tuple les champs d'une ligne, sauf celui d'indice skip
+// ((size_t) -1 pour les garder tous) ; comme write_rows, une ligne réduite à sa key
+// donne un champ vide
+// return 0 si réussit
+
+int split_row(Tuple* tuple, csv_const_row row, size_t skip){
+    size_t before = tuple->mCount;
+    const char* field = row;
+    size_t i;
+    for (i = 0; ; i++){
+        size_t len = 0;
+        field = row_field(field, 0, &len);
+        if (i != skip && 0 != push_field(tuple, field, len))
+            return -1;
+        field += len;
+        if (*field++ != CSV_SEPARATOR)
+            break;
+    }
+    if (tuple->mCount == before)
+        return push_field(tuple, row, 0);
+    return 0;
+}
+
+// fonction qui retourne le nombre de champs que split_row ajoute pour la ligne row,
+// sans son champ d'indice skip
+
+size_t row_width(csv_const_row row, size_t skip){
+    size_t count = 1;
+    for (; *row != '\0'; row++)
+        if (*row == CSV_SEPARATOR)
+            count++;
+    return skip < count && count > 1 ? count - 1 : count;
+}
+
+// fonction pour écrire un tuple comme une ligne CSV
+
+void write_tuple(FILE* out, const Tuple* tuple){
+    size_t i;
+    for (i = 0; i < tuple->mCount; i++){
+        if (i > 0)
+            fputc(CSV_SEPARATOR, out);
+        fwrite(tuple->mFields[i].mStart, 1, tuple->mFields[i].mLen, out);
+    }
+    fputc('\n', out);
+}
+
+// fonction pour ajouter une étape décrite par "FICHIER:COLONNE:COLONNE_TUPLE"
+// return 0 si réussit, -1 si la description est invalide
+
+int add_stage(Pipeline* pipeline, const char* description){
+    const char* tuple_col = strrchr(description, ':');
+    if (tuple_col == NULL || tuple_col == description)
+        return -1;
+    const char* col = tuple_col - 1;
+    while (col > description && *col != ':')
+        col--;
+    if (col == description)
+        return -1;
+
+    JoinStage stage;
+    memset(&stage, 0, sizeof(stage));
+    char number[32];
+    size_t len = tuple_col - col - 1;
+    if (len >= sizeof(number))
+        return -1;
+    memcpy(number, col + 1, len);
+    number[len] = '\0';
+    if (parse_size_t(number, &stage.mColumn) || parse_size_t(tuple_col + 1, &stage.mTupleColumn))
+        return -1;
+
+    JoinStage* stages = realloc(pipeline->mStages, (pipeline->mCount + 1) * sizeof(JoinStage));
+    if (stages == NULL)
+        return -1;
+    pipeline->mStages = stages;
+    Tuple* tuples = realloc(pipeline->mTuples, (pipeline->mCount + 2) * sizeof(Tuple));
+    if (tuples == NULL)
+        return -1;
+    pipeline->mTuples = tuples;
+    if (pipeline->mCount == 0)
+        memset(&tuples[0], 0, sizeof(Tuple));
+    memset(&tuples[pipeline->mCount + 1], 0, sizeof(Tuple));
+    if ((stage.mSource = malloc(col - description + 1)) == NULL)
+        return -1;
+    memcpy(stage.mSource, description, col - description);
+    stage.mSource[col - description] = '\0';
+    pipeline->mStages[pipeline->mCount++] = stage;
+    return 0;
+}
+
+// fonction pour charger la relation d'une étape dans son Htable (lue par blocs
+// de "block" octets, cf. open_reader)
+// return 0 si réussit
+
+int load_stage(JoinStage* stage, KeyType type, size_t block, int threads){
+    struct stat st;
+    FILE* in = fopen(stage->mSource, "r");
+    if (in == NULL || 0 != fstat(fileno(in), &st)){
+        perror(stage->mSource);
+        if (in != NULL) fclose(in);
+        return -1;
+    }
+    RowReader reader;
+    open_reader(&reader, in, stage->mSource, block, threads);
+    init_KeyCodec(&stage->mCodec, type);
+
+    size_t bad_keys = 0;
+    stage->mHeader = reader_row(&reader);
+    if (stage->mHeader == NULL || strlen(stage->mHeader) == 0)
+        fprintf(stderr, "On ne peut pas lire l'en-tête de \"%s\"\n", stage->mSource);
+    else
+        stage->mTable = load_Htable(&reader, stage->mColumn, &stage->mCodec,
+                                    (size_t) st.st_size / (strlen(stage->mHeader) + 1) + 1, &bad_keys);
+    if (bad_keys > 0)
+        fprintf(stderr, "\"%s\" : %zu ligne(s) ignorée(s), key invalide\n", stage->mSource, bad_keys);
+    int success = stage->mTable == NULL ? -1 : 0;
+    if (0 != close_reader(&reader) && success == 0){
+        fprintf(stderr, "Erreur de lecture de \"%s\"\n", stage->mSource);
+        success = -1;
+    }
+    fclose(in);
+    return success;
+}
+
+// fonction qui vérifie, avant que rien ne soit écrit, que la colonne de join de chaque
+// étape existe dans le tuple qui y entre : le join de header1 et header2 (sans sa colonne
+// col2), puis l'en-tête de chaque dimension suivi du tuple précédent sans sa colonne de join
+// return 0 si réussit
+
+int check_pipeline(const Pipeline* pipeline, csv_const_row header1, csv_const_row header2, size_t col2){
+    size_t width = row_width(header1, (size_t) -1) + row_width(header2, col2), i;
+    for (i = 0; pipeline != NULL && i < pipeline->mCount; i++){
+        const JoinStage* stage = &pipeline->mStages[i];
+        if (stage->mTupleColumn >= width){
+            fprintf(stderr, "Étape %zu : \"%s\" se joint sur la colonne %zu, mais le join précédent"
+                    " n'a que %zu colonne(s)\n", i + 1, stage->mSource, stage->mTupleColumn, width);
+            return -1;
+        }
+        width = row_width(stage->mHeader, (size_t) -1) + (width > 1 ? width - 1 : 1);
+    }
+    return 0;
+}
+
+// fonction qui retourne la mémoire occupée par les tables des étapes
+
+size_t pipeline_bytes(const Pipeline* pipeline){
+    size_t bytes = 0, i;
+    for (i = 0; pipeline != NULL && i < pipeline->mCount; i++)
+        if (pipeline->mStages[i].mTable != NULL)
+            bytes += pipeline->mStages[i].mTable->mBytes + pipeline->mStages[i].mCodec.mDict.mBytes;
+    return bytes;
+}
+
+// fonction qui fait passer la ligne jointe (build, probe sans sa colonne col) par les
+// étapes du pipeline et l'écrit si elle les traverse toutes ; pour l'en-tête (header),
+// les étapes ajoutent leur en-tête sans rien chercher
+// return le nombre de lignes écrites
+
+size_t emit_rows(FILE* out, Pipeline* pipeline, csv_const_row build, csv_const_row probe, size_t col, int header){
+    if (pipeline == NULL || pipeline->mCount == 0){
+        write_rows(out, build, probe, col);
+        return 1;
+    }
+    Tuple* tuple = &pipeline->mTuples[0];
+    tuple->mCount = 0;
+    if (0 != split_row(tuple, build, (size_t) -1) || 0 != split_row(tuple, probe, col)){
+        fprintf(stderr, "On ne peut pas allouer un tuple\n");
+        return 0;
+    }
+    return emit_stage(out, pipeline, 0, header);
+}
+
+// fonction qui joint le tuple mTuples[i] à l'étape i, puis passe le résultat à l'étape
+// suivante ; une key présente plusieurs fois dans la dimension donne un tuple par ligne
+// return le nombre de lignes écrites
+
+size_t emit_stage(FILE* out, Pipeline* pipeline, size_t i, int header){
+    Tuple* tuple = &pipeline->mTuples[i];
+    if (i == pipeline->mCount){
+        write_tuple(out, tuple);
+        return 1;
+    }
+    JoinStage* stage = &pipeline->mStages[i];
+    if (stage->mTupleColumn >= tuple->mCount)
+        return 0;
+    const void* header_row = stage->mHeader;
+    const void* const* rows = &header_row;
+    size_t count = 1;
+    if (!header){
+        const TupleField* field = &tuple->mFields[stage->mTupleColumn];
+        const Bucket* bucket;
+        key_word key;
+        if (0 != encode_probe_key(&stage->mCodec, field->mStart, field->mLen, &key)
+            || (bucket = find_Htable_bucket(stage->mTable, key)) == NULL)
+            return 0;
+        count = bucket_rows(bucket, &rows);
+        stage->mHits += count;
+    }
+
+    // la ligne de la dimension d'abord, puis le tuple sans sa colonne de join
+    Tuple* next = &pipeline->mTuples[i + 1];
+    size_t written = 0, r, j;
+    for (r = 0; r < count; r++){
+        next->mCount = 0;
+        if (0 != split_row(next, rows[r], (size_t) -1)){
+            fprintf(stderr, "On ne peut pas allouer un tuple\n");
+            return written;
+        }
+        for (j = 0; j < tuple->mCount; j++)
+            if (j != stage->mTupleColumn && 0 != push_field(next, tuple->mFields[j].mStart, tuple->mFields[j].mLen))
+                return written;
+        if (tuple->mCount == 1 && 0 != push_field(next, "", 0))
+            return written;
+        written += emit_stage(out, pipeline, i + 1, header);
+    }
+    return written;
+}
+
+// fonction pour afficher ce qu'a fait chaque étape
+
+void print_pipeline_stats(FILE* f, const Pipeline* pipeline){
+    size_t i;
+    for (i = 0; pipeline != NULL && i < pipeline->mCount; i++){
+        const JoinStage* stage = &pipeline->mStages[i];
+        fprintf(f, "Étape %zu : \"%s\", %zu lignes en mémoire, %zu tuple(s) joint(s)\n", i + 1,
+                stage->mSource, stage->mTable == NULL ? 0 : stage->mTable->mRows, stage->mHits);
+    }
+}
+
+// fonction pour détruire les étapes d'un pipeline et leurs tables
+
+void delete_Pipeline(Pipeline* pipeline){
+    size_t i;
+    for (i = 0; i < pipeline->mCount; i++){
+        JoinStage* stage = &pipeline->mStages[i];
+        if (stage->mTable != NULL)
+            delete_Htable_and_content(stage->mTable);
+        clear_Dictionary(&stage->mCodec.mDict);
+        free(stage->mHeader);
+        free(stage->mSource);
+    }
+    free(pipeline->mStages);
+    for (i = 0; pipeline->mTuples != NULL && i <= pipeline->mCount; i++)
+        free(pipeline->mTuples[i].mFields);
+    free(pipeline->mTuples);
+    pipeline->mTuples = NULL;
+    pipeline->mStages = NULL;
+    pipeline->mCount = 0;
+}
+
+/* ======================================================================
+ * Part VI -- Read-ahead and write-behind I/O threads
+ * ======================================================================
+ */
+
+// fonction qui choisit la taille des blocs d'entrée/sortie pour un budget : les 6 blocs
+// (2 par relation lue, 2 pour la sortie) en prennent au plus 3/16
+// return un multiple de IO_ALIGNMENT
+
+size_t io_block_for_budget(size_t budget){
+    size_t block = budget / 32 / IO_ALIGNMENT * IO_ALIGNMENT;
+    return block < IO_ALIGNMENT ? IO_ALIGNMENT : block > IO_MAX_BLOCK ? IO_MAX_BLOCK : block;
+}
+
+// fonction pour lire jusqu'à n octets du fichier (les octets du préfixe d'abord)
+// dans le thread de lecture, seul read peut être interrompu par pthread_cancel
+// return le nombre d'octets lus, moins de n à la fin du fichier, -1 en cas d'erreur
+
+ssize_t read_raw(ReadAhead* ahead, void* buffer, size_t n){
+    char* p = buffer;
+    size_t len = ahead->mPrefixLen - ahead->mPrefixPos;
+    if (len > n)
+        len = n;
+    memcpy(p, ahead->mPrefix + ahead->mPrefixPos, len);
+    ahead->mPrefixPos += len;
+    while (len < n){
+#ifndef CSV_JOIN_NO_THREADS
+        if (ahead->mThreaded)
+            pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+#endif
+        ssize_t r = read(ahead->mFd, p + len, n - len);
+#ifndef CSV_JOIN_NO_THREADS
+        if (ahead->mThreaded)
+            pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+#endif
+        if (r > 0)
+            len += r;
+        else if (r == 0)
+            break;
+        else if (errno != EINTR)
+            return -1;
+    }
+    return len;
+}
+
+// fonction pour (re)commencer la lecture au début du fichier : lit ses premiers octets
+// pour reconnaître le format et prépare la décompression
+// return 0 si réussit
+
+int open_input(ReadAhead* ahead){
+    ahead->mPrefixLen = ahead->mPrefixPos = 0;
+    ssize_t n = read_raw(ahead, ahead->mPrefix, BGZF_HEADER_SIZE);
+    if (n < 0)
+        return -1;
+    ahead->mPrefixLen = n;
+    ahead->mRawLen = ahead->mRawPos = 0;
+    ahead->mRawEnd = 0;
+    ahead->mMemberDone = 0;
+    ahead->mMemberCount = 0;
+
+    InputFormat format = detect_format(ahead->mPrefix, n, ahead->mBlockSize);
+    if (ahead->mRaw != NULL){   // relecture d'un fichier compressé
+        if (format != ahead->mFormat)
+            return -1;
+        if (format == INPUT_GZIP && Z_OK != inflateReset(&ahead->mStream))
+            return -1;
+        ahead->mStream.avail_in = 0;
+        return 0;
+    }
+    ahead->mFormat = format;
+    if (format == INPUT_PLAIN)
+        return 0;
+
+    ahead->mRawSize = ahead->mBlockSize + (format == INPUT_BGZF ? BGZF_MAX_MEMBER : 0);
+    if ((ahead->mRaw = malloc(ahead->mRawSize)) == NULL)
+        return -1;
+    if (format == INPUT_GZIP){
+        memset(&ahead->mStream, 0, sizeof(z_stream));
+        if (Z_OK == inflateInit2(&ahead->mStream, 15 + 16))     // 16 : en-tête gzip
+            return 0;
+    } else {
+        // des membres de 4 Kio au moins remplissent le bloc ; plus petits, le lot s'arrête
+        ahead->mMemberCapacity = ahead->mBlockSize / 4096 + 1;
+        if ((ahead->mMembers = malloc(ahead->mMemberCapacity * sizeof(BgzfMember))) != NULL)
+            return 0;
+    }
+    free(ahead->mRaw);
+    ahead->mRaw = NULL;
+    return -1;
+}
+
+// fonction pour libérer l'état de décompression
+
+void close_input(ReadAhead* ahead){
+    if (ahead->mRaw != NULL && ahead->mFormat == INPUT_GZIP)
+        inflateEnd(&ahead->mStream);
+    free(ahead->mRaw);
+    free(ahead->mMembers);
+    ahead->mRaw = NULL;
+    ahead->mMembers = NULL;
+}
+
+// fonction pour remplir un bloc avec la suite du fichier, décompressée s'il le faut
+// return 1 à la fin du fichier, 0 s'il reste des données, -1 en cas d'erreur
+
+int fill_block(ReadAhead* ahead, char* block, size_t* len){
+    if (ahead->mFormat == INPUT_GZIP)
+        return fill_gzip(ahead, block, len);
+    if (ahead->mFormat == INPUT_BGZF)
+        return fill_bgzf(ahead, block, len);
+    ssize_t n = read_raw(ahead, block, ahead->mBlockSize);
+    *len = n < 0 ? 0 : (size_t) n;
+    return n < 0 ? -1 : *len < ahead->mBlockSize;
+}
+
+#ifndef CSV_JOIN_NO_THREADS
+
+// fonction exécutée par le thread de lecture : remplit les deux blocs à tour de rôle,
+// dès que le join a fini d'en consommer un
+
+void* read_ahead_thread(void* arg){
+    ReadAhead* ahead = arg;
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    pthread_mutex_lock(&ahead->mLock);
+    while (!ahead->mStop && !ahead->mEnd){
+        int b = ahead->mNext;
+        if (ahead->mReady[b]){
+            pthread_cond_wait(&ahead->mChanged, &ahead->mLock);
+            continue;
+        }
+        pthread_mutex_unlock(&ahead->mLock);
+
+        size_t len = 0;
+        int status = fill_block(ahead, ahead->mBlocks[b], &len);
+
+        pthread_mutex_lock(&ahead->mLock);
+        ahead->mLength[b] = len;
+        ahead->mReady[b] = 1;
+        ahead->mNext = 1 - b;
+        if (status != 0){
+            ahead->mEnd = 1;
+            ahead->mFailed |= (status < 0);
+        }
+        pthread_cond_broadcast(&ahead->mChanged);
+    }
+    pthread_mutex_unlock(&ahead->mLock);
+    return NULL;
+}
+
+#endif
+
+// fonction pour commencer la lecture par blocs du fichier fd, à partir de sa position,
+// par un thread si threaded (si on ne peut pas le lancer, les blocs sont remplis à la
+// demande) ; bgzip est décompressé par autant de threads que de processeurs
+// return 0 si réussit
+
+int start_read_ahead(ReadAhead* ahead, int fd, size_t block, int threaded){
+    memset(ahead, 0, sizeof(ReadAhead));
+    ahead->mFd = fd;
+    ahead->mBlockSize = block;
+#ifndef CSV_JOIN_NO_THREADS
+    ahead->mThreaded = threaded;
+#else
+    (void) threaded;
+#endif
+    if (0 != posix_memalign((void**) &ahead->mBlocks[0], IO_ALIGNMENT, block))
+        ahead->mBlocks[0] = NULL;
+    if (0 != posix_memalign((void**) &ahead->mBlocks[1], IO_ALIGNMENT, block))
+        ahead->mBlocks[1] = NULL;
+    if (ahead->mBlocks[0] == NULL || ahead->mBlocks[1] == NULL || 0 != open_input(ahead)){
+        free(ahead->mBlocks[0]);
+        free(ahead->mBlocks[1]);
+        return -1;
+    }
+#ifndef CSV_JOIN_NO_THREADS
+#ifdef _SC_NPROCESSORS_ONLN
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ahead->mThreaded && ahead->mFormat == INPUT_BGZF && processors > 1)
+        ahead->mWorkers = processors - 1 > BGZF_MAX_WORKERS ? BGZF_MAX_WORKERS : processors - 1;
+#endif
+    pthread_mutex_init(&ahead->mLock, NULL);
+    pthread_cond_init(&ahead->mChanged, NULL);
+    pthread_mutex_init(&ahead->mMemberLock, NULL);
+    if (ahead->mThreaded && 0 != pthread_create(&ahead->mThread, NULL, read_ahead_thread, ahead))
+        ahead->mThreaded = 0;
+#endif
+    return 0;
+}
+
+// fonction pour arrêter le thread de lecture (les blocs restent alloués)
+
+void stop_read_ahead(ReadAhead* ahead){
+#ifndef CSV_JOIN_NO_THREADS
+    if (ahead->mThreaded && !ahead->mStop){
+        pthread_mutex_lock(&ahead->mLock);
+        ahead->mStop = 1;
+        pthread_cond_broadcast(&ahead->mChanged);
+        pthread_mutex_unlock(&ahead->mLock);
+        pthread_cancel(ahead->mThread);     // s'il attend des données d'un tube
+        pthread_join(ahead->mThread, NULL);
+    }
+#endif
+    ahead->mStop = 1;
+}
+
+// fonction pour reprendre la lecture par blocs au début du fichier
+// return 0 si réussit
+
+int restart_read_ahead(ReadAhead* ahead){
+    stop_read_ahead(ahead);
+    ahead->mReady[0] = ahead->mReady[1] = 0;
+    ahead->mNext = ahead->mCurrent = ahead->mHolding = 0;
+    ahead->mPos = 0;
+    ahead->mEnd = ahead->mStop = 0;       // mFailed reste : le résultat est déjà incomplet
+    if (-1 == lseek(ahead->mFd, 0, SEEK_SET) || 0 != open_input(ahead)){
+        ahead->mEnd = ahead->mStop = 1;     // reader_row ne retourne plus que ""
+        return -1;
+    }
+#ifndef CSV_JOIN_NO_THREADS
+    if (ahead->mThreaded && 0 != pthread_create(&ahead->mThread, NULL, read_ahead_thread, ahead))
+        ahead->mThreaded = 0;
+#endif
+    return 0;
+}
+
+// fonction pour arrêter le thread de lecture et libérer les blocs
+
+void delete_read_ahead(ReadAhead* ahead){
+    stop_read_ahead(ahead);
+#ifndef CSV_JOIN_NO_THREADS
+    pthread_mutex_destroy(&ahead->mLock);
+    pthread_cond_destroy(&ahead->mChanged);
+    pthread_mutex_destroy(&ahead->mMemberLock);
+#endif
+    close_input(ahead);
+    free(ahead->mBlocks[0]);
+    free(ahead->mBlocks[1]);
+}
+
+// fonction qui attend que le bloc mCurrent soit rempli (sans thread, le remplit)
+// return 0 si réussit, -1 à la fin du fichier ou après une erreur (mFailed)
+
+int wait_block(ReadAhead* ahead){
+    int b = ahead->mCurrent, ready = 0;
+    uint64_t start = PROFILE_TICKS();
+    if (!ahead->mThreaded){
+        if (!ahead->mEnd){
+            int status = fill_block(ahead, ahead->mBlocks[b], &ahead->mLength[b]);
+            ahead->mReady[b] = 1;
+            if (status != 0){
+                ahead->mEnd = 1;
+                ahead->mFailed |= (status < 0);
+            }
+        }
+        ready = ahead->mReady[b] && !ahead->mFailed;
+    } else {
+#ifndef CSV_JOIN_NO_THREADS
+        pthread_mutex_lock(&ahead->mLock);
+        while (!ahead->mReady[b] && !ahead->mEnd)
+            pthread_cond_wait(&ahead->mChanged, &ahead->mLock);
+        ready = ahead->mReady[b] && !ahead->mFailed;
+        pthread_mutex_unlock(&ahead->mLock);
+#endif
+    }
+    PROFILE_ADD(ahead->mWaitTicks, start);
+    return ready ? 0 : -1;
+}
+
+// fonction pour arrêter la lecture après une erreur du join (ligne trop longue) :
+// read_ahead_row ne retourne plus que ""
+
+void fail_read_ahead(ReadAhead* ahead){
+    if (!ahead->mThreaded){
+        ahead->mFailed = 1;
+    } else {
+#ifndef CSV_JOIN_NO_THREADS
+        pthread_mutex_lock(&ahead->mLock);
+        ahead->mFailed = 1;
+        pthread_mutex_unlock(&ahead->mLock);
+#endif
+    }
+    ahead->mHolding = 0;
+}
+
+// fonction pour rendre le bloc mCurrent, entièrement consommé, et passer à l'autre
+
+void release_block(ReadAhead* ahead){
+    if (!ahead->mThreaded){
+        ahead->mReady[ahead->mCurrent] = 0;
+    } else {
+#ifndef CSV_JOIN_NO_THREADS
+        pthread_mutex_lock(&ahead->mLock);
+        ahead->mReady[ahead->mCurrent] = 0;
+        pthread_cond_broadcast(&ahead->mChanged);
+        pthread_mutex_unlock(&ahead->mLock);
+#endif
+    }
+    ahead->mCurrent = 1 - ahead->mCurrent;
+    ahead->mHolding = 0;
+}
+
+// fonction pour lire la ligne suivante dans les blocs, comme read_row
+// return la ligne allouée, "" à la fin ou après une erreur, NULL si on ne peut pas allouer
+
+csv_row read_ahead_row(ReadAhead* ahead){
+    char line[CSV_MAX_LINE_SIZE + 1];
+    size_t len = 0;
+    int found = 0;
+    while (!found){
+        if (!ahead->mHolding){
+            if (0 != wait_block(ahead))
+                break;          // fin du fichier
+            ahead->mHolding = 1;
+            ahead->mPos = 0;
+        }
+
+        const char* start = ahead->mBlocks[ahead->mCurrent] + ahead->mPos;
+        size_t available = ahead->mLength[ahead->mCurrent] - ahead->mPos;
+        const char* end = memchr(start, '\n', available);
+        size_t n = end != NULL ? (size_t) (end - start) : available;
+        if (len + n >= CSV_MAX_LINE_SIZE){  // données invalides : on s'arrête là
+            fprintf(stderr, "Ligne de plus de %d caractères\n", CSV_MAX_LINE_SIZE - 1);
+            fail_read_ahead(ahead);
+            len = 0;
+            break;
+        }
+        memcpy(line + len, start, n);
+        len += n;
+        ahead->mPos += n + (end != NULL);
+        found = (end != NULL);
+
+        if (ahead->mPos == ahead->mLength[ahead->mCurrent])
+            release_block(ahead);
+    }
+    line[len] = '\0';
+    line[strcspn(line, "\r\n")] = '\0';
+    len = strlen(line);
+
+    csv_row row;
+    if ((row = calloc(len + 1, sizeof(char))) == NULL) {
+        return NULL;
+    }
+    memcpy(row, line, len);
+    return row;
+}
+
+#ifndef CSV_JOIN_NO_THREADS
+
+// fonction exécutée par le thread d'écriture : accumule ce qui arrive du tube dans
+// un bloc et l'écrit dans le fichier quand il est plein (ou à la fin)
+// après une erreur, le tube est encore vidé pour que le join ne reste pas bloqué
+
+void* write_behind_thread(void* arg){
+    WriteBehind* writer = arg;
+    int end = 0;
+    while (!end){
+        size_t len = 0;
+        while (len < writer->mBlockSize){
+            ssize_t n = read(writer->mPipe[0], writer->mBlock + len, writer->mBlockSize - len);
+            if (n > 0)
+                len += n;
+            else if (n == 0 || errno != EINTR){
+                end = 1;
+                writer->mError |= (n < 0);
+                break;
+            }
+        }
+        size_t done = 0;
+        while (!writer->mError && done < len){
+            ssize_t n = write(writer->mFd, writer->mBlock + done, len - done);
+            if (n > 0)
+                done += n;
+            else if (n < 0 && errno != EINTR)
+                writer->mError = 1;
+        }
+    }
+    return NULL;
+}
+
+// fonction pour lancer l'écriture différée dans out (vidé d'abord)
+// return le FILE* où le join doit écrire, NULL si on ne peut pas lancer le thread
+
+FILE* start_write_behind(WriteBehind* writer, FILE* out, size_t block){
+    memset(writer, 0, sizeof(WriteBehind));
+    writer->mFd = fileno(out);
+    writer->mBlockSize = block;
+    if (0 != fflush(out) || 0 != posix_memalign((void**) &writer->mBlock, IO_ALIGNMENT, block))
+        return NULL;
+    if (0 != pipe(writer->mPipe)){
+        free(writer->mBlock);
+        return NULL;
+    }
+    FILE* joined = fdopen(writer->mPipe[1], "w");
+    if (joined == NULL || 0 != setvbuf(joined, NULL, _IOFBF, block)
+        || 0 != pthread_create(&writer->mThread, NULL, write_behind_thread, writer)){
+        if (joined != NULL) fclose(joined);
+        else close(writer->mPipe[1]);
+        close(writer->mPipe[0]);
+        free(writer->mBlock);
+        return NULL;
+    }
+    return joined;
+}
+
+// fonction pour terminer l'écriture différée : ferme le FILE* du join et attend que
+// le thread ait tout écrit
+// return 0 si réussit
+
+int finish_write_behind(WriteBehind* writer, FILE* joined){
+    int success = fclose(joined);   // le thread voit la fin du tube
+    pthread_join(writer->mThread, NULL);
+    close(writer->mPipe[0]);
+    free(writer->mBlock);
+    if (writer->mError)
+        fprintf(stderr, "Erreur d'écriture du résultat\n");
+    return (success == 0 && !writer->mError) ? 0 : -1;
+}
+
+#else
+
+// version sans threads : la sortie passe directement par stdio
+
+FILE* start_write_behind(WriteBehind* writer, FILE* out, size_t block){
+    (void) writer; (void) out; (void) block;
+    return NULL;
+}
+
+int finish_write_behind(WriteBehind* writer, FILE* joined){
+    (void) writer;
+    return fclose(joined);
+}
+
+#endif
+
+/* ======================================================================
+ * Part VII -- Compressed inputs (gzip, bgzip)
+ * ======================================================================
+ */
+
+// fonction qui dit si p commence par l'en-tête d'un membre bgzip (champ extra "BC")
+
+int is_bgzf_header(const unsigned char* p){
+    return p[0] == 0x1f && p[1] == 0x8b && p[2] == 8 && (p[3] & 4) != 0 && p[10] == 6 && p[11] == 0
+           && p[12] == 'B' && p[13] == 'C' && p[14] == 2 && p[15] == 0;
+}
+
+// fonction qui reconnaît le format d'une entrée à ses premiers octets ; bgzip n'est
+// décompressé par lots que si un membre tient dans un bloc, en continu sinon
+
+InputFormat detect_format(const unsigned char* p, size_t len, size_t block){
+    if (len < 2 || p[0] != 0x1f || p[1] != 0x8b)
+        return INPUT_PLAIN;
+    if (len >= BGZF_HEADER_SIZE && block >= BGZF_MAX_MEMBER && is_bgzf_header(p))
+        return INPUT_BGZF;
+    return INPUT_GZIP;
+}
+
+// fonction qui lit un entier de 32 bits petit-boutiste
+
+uint32_t read_le32(const unsigned char* p){
+    return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+// fonction pour remplir un bloc en décompressant le flux gzip en continu ; les membres
+// qui se suivent (fichiers gzip concaténés) sont décompressés l'un après l'autre
+// return 1 à la fin du fichier, 0 s'il reste des données, -1 si le fichier est invalide
+
+int fill_gzip(ReadAhead* ahead, char* block, size_t* len){
+    z_stream* z = &ahead->mStream;
+    int status = 0;
+    z->next_out = (Bytef*) block;
+    z->avail_out = ahead->mBlockSize;
+    while (z->avail_out > 0){
+        if (z->avail_in == 0){
+            if (ahead->mRawEnd){
+                status = ahead->mMemberDone ? 1 : -1;   // sinon : fichier tronqué
+                break;
+            }
+            ssize_t n = read_raw(ahead, ahead->mRaw, ahead->mRawSize);
+            if (n < 0){
+                status = -1;
+                break;
+            }
+            ahead->mRawEnd = ((size_t) n < ahead->mRawSize);
+            z->next_in = ahead->mRaw;
+            z->avail_in = n;
+            continue;
+        }
+        if (ahead->mMemberDone){    // un autre membre suit
+            inflateReset(z);
+            ahead->mMemberDone = 0;
+        }
+        int ret = inflate(z, Z_NO_FLUSH);
+        if (ret == Z_STREAM_END)
+            ahead->mMemberDone = 1;
+        else if (ret != Z_OK){
+            status = -1;
+            break;
+        }
+    }
+    *len = ahead->mBlockSize - z->avail_out;
+    return status;
+}
+
+// fonction exécutée par chaque thread de décompression, et par celui de lecture :
+// décompresse les membres du lot l'un après l'autre tant qu'il en reste, et vérifie
+// leur taille et leur CRC
+
+void* inflate_members(void* arg){
+    ReadAhead* ahead = arg;
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    int bad = (Z_OK != inflateInit2(&z, -15));     // deflate brut : en-têtes déjà lus
+    for (;;){
+#ifndef CSV_JOIN_NO_THREADS
+        pthread_mutex_lock(&ahead->mMemberLock);
+#endif
+        size_t i = ahead->mNextMember++;
+        if (bad)
+            ahead->mBadMember = 1;
+#ifndef CSV_JOIN_NO_THREADS
+        pthread_mutex_unlock(&ahead->mMemberLock);
+#endif
+        if (bad || i >= ahead->mMemberCount)
+            break;
+
+        BgzfMember* member = &ahead->mMembers[i];
+        if (member->mLen == 0)      // bloc de fin
+            continue;
+        z.next_in = (Bytef*) member->mData;
+        z.avail_in = member->mSize;
+        z.next_out = (Bytef*) member->mOut;
+        z.avail_out = member->mLen;
+        bad = Z_STREAM_END != inflate(&z, Z_FINISH) || z.avail_out != 0
+              || member->mCrc != crc32(0L, (const Bytef*) member->mOut, member->mLen);
+        inflateReset(&z);
+    }
+    inflateEnd(&z);
+    return NULL;
+}
+
+// fonction pour remplir un bloc avec des membres bgzip entiers : leurs tailles sont
+// dans les en-têtes et les fins, on sait donc où chacun va dans le bloc sans les
+// décompresser, et les threads de décompression s'en partagent le lot
+// return 1 à la fin du fichier, 0 s'il reste des données, -1 si le fichier est invalide
+
+int fill_bgzf(ReadAhead* ahead, char* block, size_t* len){
+    size_t out = 0;
+    int status = 0;
+    // plus aucun membre ne pointe dans mRaw : le reste revient au début
+    memmove(ahead->mRaw, ahead->mRaw + ahead->mRawPos, ahead->mRawLen - ahead->mRawPos);
+    ahead->mRawLen -= ahead->mRawPos;
+    ahead->mRawPos = 0;
+    ahead->mMemberCount = 0;
+
+    while (ahead->mMemberCount < ahead->mMemberCapacity){
+        size_t available = ahead->mRawLen - ahead->mRawPos;
+        if (available < BGZF_MAX_MEMBER && !ahead->mRawEnd && ahead->mRawLen < ahead->mRawSize){
+            ssize_t n = read_raw(ahead, ahead->mRaw + ahead->mRawLen, ahead->mRawSize - ahead->mRawLen);
+            if (n < 0){
+                status = -1;
+                break;
+            }
+            ahead->mRawEnd = ((size_t) n < ahead->mRawSize - ahead->mRawLen);
+            ahead->mRawLen += n;
+            continue;
+        }
+        if (available == 0 && ahead->mRawEnd){
+            status = 1;
+            break;
+        }
+        // après le memmove il y a toujours la place d'un membre entier : un membre
+        // incomplet ici attend le lot suivant, ou le fichier est tronqué
+        const unsigned char* h = ahead->mRaw + ahead->mRawPos;
+        size_t size = available < BGZF_HEADER_SIZE ? 0 : ((size_t) h[16] | (size_t) h[17] << 8) + 1;
+        if (size == 0 || available < size){
+            if (ahead->mRawEnd)
+                status = -1;
+            break;
+        }
+        if (!is_bgzf_header(h) || size < BGZF_HEADER_SIZE + BGZF_FOOTER_SIZE
+            || read_le32(h + size - 4) > BGZF_MAX_MEMBER){
+            status = -1;
+            break;
+        }
+        size_t isize = read_le32(h + size - 4);
+        if (out + isize > ahead->mBlockSize)
+            break;
+        BgzfMember* member = &ahead->mMembers[ahead->mMemberCount++];
+        member->mData = h + BGZF_HEADER_SIZE;
+        member->mSize = size - BGZF_HEADER_SIZE - BGZF_FOOTER_SIZE;
+        member->mOut = block + out;
+        member->mLen = isize;
+        member->mCrc = read_le32(h + size - 8);
+        out += isize;
+        ahead->mRawPos += size;
+    }
+
+    ahead->mNextMember = 0;
+    ahead->mBadMember = 0;
+#ifndef CSV_JOIN_NO_THREADS
+    pthread_t workers[BGZF_MAX_WORKERS];
+    size_t started = 0, i;
+    while (started < ahead->mWorkers && started + 1 < ahead->mMemberCount
+           && 0 == pthread_create(&workers[started], NULL, inflate_members, ahead))
+        started++;
+    inflate_members(ahead);
+    for (i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
+#else
+    inflate_members(ahead);
+#endif
+    if (ahead->mBadMember){     // rien du bloc n'est sûr : on ne le rend pas
+        status = -1;
+        out = 0;
+    }
+    *len = out;
+    return status;
+}
+
+/* ======================================================================
+ * Provided: main()
+ * ======================================================================
+ */
+
+/** ----------------------------------------------------------------------
+ ** Print the command-line usage
+ **/
+void usage(const char* program)
+{
+    fprintf(stderr,
+            "usage : %s [-cS] [-k auto|int|string] [-i INDEX] [-j R3:COL3:COL ... | -s | -x | -a AGG ...]\n"
+            "           [-J STATS] [R1 R2 OUT COL1 COL2 MEMOIRE]\n"
+            "        %s [-cS] [-k auto|int|string] -I INDEX R1 COL1\n"
+            "        sans fichiers, les paramètres sont demandés interactivement\n"
+            "  -k    type des keys de join (auto par défaut : entiers si toutes les\n"
+            "        keys de R1 sont des entiers canoniques, chaînes sinon)\n"
+            "  -I    construit l'index de R1 sur la colonne COL1 dans le fichier INDEX\n"
+            "  -i    sonde l'index INDEX de R1 au lieu de reconstruire la table\n"
+            "        (ignoré si l'index ne correspond plus à R1)\n"
+            "  -j    joint encore le résultat avec R3 : COL3 dans R3, COL dans le résultat\n"
+            "        (numérotée comme dans le CSV que donnerait le join précédent) ;\n"
+            "        R3 est chargé entièrement en mémoire, sur le budget ; répétable\n"
+            "  -s    semi-join : les lignes de R2 dont la key est dans R1, sans les joindre\n"
+            "  -x    anti-join : les lignes de R2 dont la key n'est pas dans R1\n"
+            "  -a    group-join : chaque ligne de R1 suivie d'un agrégat des lignes de R2\n"
+            "        de même key, AGG = count, sum:COL, min:COL ou max:COL (COL dans R2) ;\n"
+            "        répétable, un agrégat par colonne ajoutée\n"
+            "  -S    lecture et écriture synchrones, sans threads d'entrée/sortie\n"
+            "        (toujours le cas sur une machine à un seul processeur)\n"
+            "  -c    écrit le cache colonnes (FICHIER" COLUMNS_SUFFIX ") des fichiers d'entrée\n"
+            "        s'il manque ou n'est plus à jour ; un cache à jour est toujours utilisé ;\n"
+            "        le cache est construit en mémoire, et n'est pas écrit s'il dépasse\n"
+            "        MEMOIRE (avec -I, qui n'a pas de budget, il n'est pas limité)\n"
+            "  -J    écrit les statistiques du join en JSON dans le fichier STATS : plan,\n"
+            "        lots, lignes, mémoire et, sauf avec -DCSV_JOIN_NO_PROFILE, le temps\n"
+            "        de chaque phase et l'histogramme des recherches dans la table\n"
+            "  R1, R2 ou OUT peut être \"-\" (entrée ou sortie standard) : R2 est alors lue\n"
+            "        une seule fois, et si R1 ne tient pas dans le budget les deux relations\n"
+            "        sont réparties dans des partitions sur disque\n"
+            "  les fichiers compressés (gzip, bgzip) sont décompressés à la lecture ; ceux\n"
+            "        de bgzip par plusieurs threads\n",
+            program, program);
+}
+
+/** ----------------------------------------------------------------------
+ ** Parse a size given on the command line
+ **/
+int parse_size_t(const char* s, size_t* v)
+{
+    char* end = NULL;
+    unsigned long long value = strtoull(s, &end, 10);
+    if (*s == '\0' || *s == '-' || *end != '\0') {
+        return -1;
+    }
+    *v = (size_t) value;
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    Pipeline pipeline;
+    memset(&pipeline, 0, sizeof(pipeline));
+    JoinOptions options = { KEY_AUTO, &pipeline, BUFSIZ, JOIN_INNER, { { AGG_COUNT, 0 } }, 0, NULL };
+    const char* build_index_path = NULL;
+    const char* index_path = NULL;
+    int write_sidecars = 0;
+    int modes = 0;  // nombre d'options parmi -s, -x et -a
+    // threads d'entrée/sortie seulement s'ils peuvent tourner à côté du join
+    int io_threads = 1;
+#ifdef _SC_NPROCESSORS_ONLN
+    io_threads = sysconf(_SC_NPROCESSORS_ONLN) != 1;
+#endif
+
+    int opt;
+    while ((opt = getopt(argc, argv, "cSsxa:k:I:i:j:J:")) != -1) {
+        switch (opt) {
+        case 's':
+        case 'x':
+            options.mMode = opt == 's' ? JOIN_SEMI : JOIN_ANTI;
+            modes++;
+            break;
+        case 'a':
+            modes += options.mAggregateCount == 0;
+            if (options.mAggregateCount == MAX_AGGREGATES
+                || 0 != parse_aggregate(optarg, &options.mAggregates[options.mAggregateCount++])) {
+                usage(argv[0]);
+                delete_Pipeline(&pipeline);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'S':
+            io_threads = 0;
+            break;
+        case 'j':
+            if (0 != add_stage(&pipeline, optarg)) {
+                usage(argv[0]);
+                delete_Pipeline(&pipeline);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'c':
+            write_sidecars = 1;
+            break;
+        case 'I':
+            build_index_path = optarg;
+            break;
+        case 'i':
+            index_path = optarg;
+            break;
+        case 'J':
+            options.mStatsPath = optarg;
+            break;
+        case 'k':
+            if (0 == strcmp(optarg, "auto"))        options.mKeyType = KEY_AUTO;
+            else if (0 == strcmp(optarg, "int"))    options.mKeyType = KEY_INT;
+            else if (0 == strcmp(optarg, "string")) options.mKeyType = KEY_STRING;
+            else {
+                usage(argv[0]);
+                delete_Pipeline(&pipeline);
+                return EXIT_FAILURE;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            delete_Pipeline(&pipeline);
+            return EXIT_FAILURE;
+        }
+    }
+    // -s, -x et -a remplacent les lignes jointes : ils s'excluent, et excluent les étapes -j
+    if (options.mAggregateCount > 0) {
+        options.mMode = JOIN_GROUP;
+    }
+    if (modes > 1 || (modes > 0 && pipeline.mCount > 0)) {
+        fprintf(stderr, "-s, -x et -a s'excluent, et ne se combinent pas avec -j\n");
+        usage(argv[0]);
+        delete_Pipeline(&pipeline);
+        return EXIT_FAILURE;
+    }
+    if (build_index_path != NULL) {
+        size_t col = 0;
+        if (argc - optind != 2 || parse_size_t(argv[optind + 1], &col)) {
+            usage(argv[0]);
+            delete_Pipeline(&pipeline);
+            return EXIT_FAILURE;
+        }
+        MappedColumns columns;
+        if (write_sidecars && 0 != map_sidecar(&columns, argv[optind])) {
+            write_sidecar(argv[optind], SIZE_MAX);
+        }
+        FILE* in = fopen(argv[optind], "r");
+        if (in == NULL) {
+            perror(argv[optind]);
+            delete_Pipeline(&pipeline);
+            return EXIT_FAILURE;
+        }
+        RowReader reader;
+        open_reader(&reader, in, argv[optind], IO_MAX_BLOCK, io_threads);
+        int success = build_index(&reader, argv[optind], col, options.mKeyType, build_index_path);
+        if (0 != close_reader(&reader) && success == 0) {
+            fprintf(stderr, "Erreur de lecture de \"%s\" : index incomplet\n", argv[optind]);
+            remove(build_index_path);
+            success = -1;
+        }
+        fclose(in);
+        delete_Pipeline(&pipeline);
+        return success == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (argc - optind != 6 && (argc - optind != 0 || index_path != NULL)) {
+        usage(argv[0]);
+        delete_Pipeline(&pipeline);
+        return EXIT_FAILURE;
+    }
+    int interactive = (argc == optind);
+    // "-" : entrée ou sortie standard ; R1 ou R2, pas les deux
+    const char* path1 = interactive || 0 == strcmp(argv[optind], "-") ? NULL : argv[optind];
+    const char* path2 = interactive || 0 == strcmp(argv[optind + 1], "-") ? NULL : argv[optind + 1];
+    if (!interactive && path1 == NULL && path2 == NULL) {
+        usage(argv[0]);
+        delete_Pipeline(&pipeline);
+        return EXIT_FAILURE;
+    }
+
+    size_t col1 = 0, col2 = 0, memory = 0;
+    if (!interactive
+        && (parse_size_t(argv[optind + 3], &col1) || parse_size_t(argv[optind + 4], &col2)
+            || parse_size_t(argv[optind + 5], &memory))) {
+        usage(argv[0]);
+        delete_Pipeline(&pipeline);
+        return EXIT_FAILURE;
+    }
+
+    // le cache est écrit avant d'ouvrir les fichiers ; il n'est projeté qu'à la lecture
+    int i;
+    for (i = 0; write_sidecars && (size_t) i < 2 + pipeline.mCount; i++) {
+        const char* source = i >= 2 ? pipeline.mStages[i - 2].mSource : (i == 0 ? path1 : path2);
+        MappedColumns columns;
+        if (source == NULL) {
+            continue;
+        } else if (0 == map_sidecar(&columns, source)) {
+            munmap((void*) columns.mBase, columns.mSize);
+        } else {
+            write_sidecar(source, interactive ? SIZE_MAX : memory);
+        }
+    }
+
+    FILE* in1 = interactive ? ask_filename_and_open("Entrez le nom du premier fichier : ", "r")
+                            : path1 == NULL ? stdin : fopen(path1, "r");
+    if (in1 == NULL) {
+        if (!interactive) perror(argv[optind]);
+        delete_Pipeline(&pipeline);
+        return EXIT_FAILURE;
+    }
+
+    FILE* in2 = interactive ? ask_filename_and_open("Entrez le nom du second  fichier : ", "r")
+                            : path2 == NULL ? stdin : fopen(path2, "r");
+    if (in2 == NULL) {
+        if (!interactive) perror(argv[optind + 1]);
+        fclose(in1);
+        delete_Pipeline(&pipeline);
+        return EXIT_FAILURE;
+    }
+
+    FILE* out = interactive ? ask_filename_and_open("Entrez le nom du fichier où écrire le résultat : ", "w")
+                            : 0 == strcmp(argv[optind + 2], "-") ? stdout : fopen(argv[optind + 2], "w");
+    if (out == NULL) {
+        if (!interactive) perror(argv[optind + 2]);
+        fclose(in1);
+        fclose(in2);
+        delete_Pipeline(&pipeline);
+        return EXIT_FAILURE;
+    }
+
+    if (interactive) {
+        col1 = ask_size_t("Entrez l'index de la colonne à joindre dans le premier fichier : ");
+        col2 = ask_size_t("Entrez l'index de la colonne à joindre dans le second  fichier : ");
+        memory = ask_size_t("Entrez le budget mémoire autorisé (en octets) : ");
+    }
+
+    // lecture et écriture par des threads, en blocs pris sur le budget
+    size_t block = io_block_for_budget(memory);
+    WriteBehind writer;
+    FILE* joined = io_threads ? start_write_behind(&writer, out, block) : NULL;
+    if (joined != NULL) {
+        options.mOutputBuffer = 2 * ALLOC_SIZE(block);
+    } else {
+        joined = out;
+    }
+
+    // R1 n'est lue (ni son cache ouvert, ni son thread de lecture lancé) que sans l'index
+    RowReader reader1, reader2;
+    open_reader(&reader1, NULL, NULL, 0, 0);
+    open_reader(&reader2, in2, path2, block, io_threads);
+    if (reader2.mColumns.mBase != NULL) {
+        fprintf(stderr, "Lecture de \"%s\" depuis son cache colonnes\n", argv[optind + 1]);
+    }
+
+    int success = 0;
+    for (i = 0; success == 0 && (size_t) i < pipeline.mCount; i++) {
+        success = load_stage(&pipeline.mStages[i], options.mKeyType, block, io_threads);
+    }
+
+    MappedIndex index;
+    if (success != 0) {
+        fprintf(stderr, "On ne peut pas charger les relations des étapes suivantes\n");
+    } else if (index_path != NULL && options.mMode != JOIN_GROUP
+               && 0 == open_index(&index, index_path, argv[optind], col1, options.mKeyType)) {
+        success = index_join(&index, &reader2, joined, col2, &options);
+        close_index(&index);
+    } else {
+        if (index_path != NULL) {
+            fprintf(stderr, "On fait le join sans l'index\n");
+        }
+        open_reader(&reader1, in1, path1, block, io_threads);
+        if (reader1.mColumns.mBase != NULL) {
+            fprintf(stderr, "Lecture de \"%s\" depuis son cache colonnes\n", argv[optind]);
+        }
+        success = hash_join(&reader1, &reader2, joined, col1, col2, memory, &options);
+    }
+    print_pipeline_stats(stderr, &pipeline);
+    delete_Pipeline(&pipeline);
+    for (i = 0; i < 2; i++) {
+        if (0 != close_reader(i == 0 ? &reader1 : &reader2)) {
+            fprintf(stderr, "Erreur de lecture ou de décompression de R%d : le résultat est incomplet\n", i + 1);
+            success = -1;
+        }
+    }
+    if (joined != out && 0 != finish_write_behind(&writer, joined) && success == 0) {
+        success = -1;
+    }
 
     fclose(in1);
     fclose(in2);
@@ -0,0 +1,549 @@
+// C99 -- table de hachage partagée (cf. hashtable.h)
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include "hashtable.h"
+
+#ifndef HTABLE_NO_STATS
+#define COUNT_PROBE(table, length, hit) count_probe(&(table)->mProbes, (length), (hit))
+#else
+#define COUNT_PROBE(table, length, hit) ((void) (length))
+#endif
+
+// comparaison de deux keys : mots égaux, ou mEqual de la table
+#define HTABLE_EQUAL(table, a, b) ((a) == (b) || ((table)->mOps->mEqual != NULL && (table)->mOps->mEqual((a), (b))))
+
+#ifdef __GNUC__
+#define HTABLE_PREFETCH(p) __builtin_prefetch(p)
+#else
+#define HTABLE_PREFETCH(p) ((void) (p))
+#endif
+
+void free_Bucket(Htable*, Bucket*);
+Bucket* search_Htable(const Htable*, htable_key, size_t*);
+
+const HtableOps HTABLE_WORD_OPS = { NULL, NULL, NULL, NULL, NULL };
+
+/* ======================================================================
+ * Fonctions de hachage
+ * ======================================================================
+ */
+
+/** ----------------------------------------------------------------------
+ ** Hash a string for a given hashtable size.
+ ** See http://en.wikipedia.org/wiki/Jenkins_hash_function
+ **/
+size_t hash_bytes(const char* key, size_t key_len)
+{
+    size_t hash = 0;
+    for (size_t i = 0; i < key_len; ++i) {
+        hash += (unsigned char) key[i];
+        hash += (hash << 10);
+        hash ^= (hash >> 6);
+    }
+    hash += (hash << 3);
+    hash ^= (hash >> 11);
+    hash += (hash << 15);
+
+    return hash;
+}
+
+size_t hash_function(const char* key, size_t size)
+{
+    return hash_bytes(key, strlen(key)) % size;
+}
+
+/** ----------------------------------------------------------------------
+ ** Hash an encoded 64-bit key (finalizer of MurmurHash3).
+ **/
+size_t hash_word(htable_key key, size_t size)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+
+    return key % size;
+}
+
+// fonctions de HtableOps pour des keys qui sont des chaînes (HTABLE_POINTER_KEY)
+
+size_t hash_string_key(htable_key key){
+    const char* s = HTABLE_KEY_POINTER(key);
+    return hash_bytes(s, strlen(s));
+}
+
+int equal_string_keys(htable_key a, htable_key b){
+    return 0 == strcmp(HTABLE_KEY_POINTER(a), HTABLE_KEY_POINTER(b));
+}
+
+// fonction qui retourne la liste de key dans un tableau de size listes
+// (hash_word sans mHash : csv_join range ses index sur disque de la même façon)
+
+size_t Htable_index(const Htable* table, htable_key key, size_t size){
+    if (table->mOps->mHash == NULL)
+        return hash_word(key, size);
+    return table->mOps->mHash(key) % size;
+}
+
+// fonction qui retourne les octets d'une valeur comptés dans mBytes
+
+size_t Htable_value_bytes(const Htable* table, const void* value){
+    return table->mOps->mValueBytes == NULL ? 0 : table->mOps->mValueBytes(value);
+}
+
+// fonction pour compter une recherche dans une table : length buckets comparés
+
+void count_probe(ProbeCounts* counts, size_t length, int hit){
+    counts->mLookups++;
+    counts->mHits += (hit != 0);
+    counts->mLengths[length < HTABLE_PROBE_HISTOGRAM ? length : HTABLE_PROBE_HISTOGRAM - 1]++;
+}
+
+/* ======================================================================
+ * Hash table
+ * ======================================================================
+ */
+
+// fonction pour construire un hash table avec sa taille ; ops doit durer autant que
+// la table, NULL : HTABLE_WORD_OPS (keys comparées comme des mots, valeurs ni
+// comptées ni libérées)
+// return NULL si on n'arrive pas à allouer
+
+Htable* construct_Htable(size_t size, const HtableOps* ops){
+    if (size < 1 || size > UINT_MAX)
+        return NULL;
+
+    Htable* table = malloc( sizeof(Htable));
+
+    if (table != NULL) {
+        table->mListOfBucket = calloc(size, sizeof(Bucket*));
+        if (table->mListOfBucket == NULL){
+            free(table);
+            table =  NULL;
+        } else {
+            table->mSize = size;
+            table->mCount = 0;
+            table->mRows = 0;
+            table->mGrowLimit = 0;
+            table->mOldSize = 0;
+            table->mOldList = NULL;
+            table->mMigrated = 0;
+            table->mOps = ops != NULL ? ops : &HTABLE_WORD_OPS;
+            table->mBytes = Htable_overhead(table);
+            memset(&table->mProbes, 0, sizeof(ProbeCounts));
+        }
+    }
+    return table;
+}
+
+// fonction qui retourne les octets de la structure et des tableaux de buckets
+
+size_t Htable_overhead(const Htable* table){
+    size_t bytes = ALLOC_SIZE(sizeof(Htable)) + ALLOC_SIZE(table->mSize * sizeof(Bucket*));
+    if (table->mOldList != NULL)
+        bytes += ALLOC_SIZE(table->mOldSize * sizeof(Bucket*));
+    return bytes;
+}
+
+// fonction pour commencer à doubler le tableau de buckets : l'ancien est gardé et ses
+// listes sont déplacées petit à petit, à chaque ajout (rehash_step_Htable), pour
+// qu'aucun ajout ne paie tout le rehash
+// return 0 si réussit, la table reste inchangée sinon
+
+int grow_Htable(Htable* table){
+    finish_rehash_Htable(table);    // un agrandissement à la fois
+    size_t size = 2 * (size_t) table->mSize;
+    if (size > UINT_MAX)
+        return -1;
+    Bucket** list = calloc(size, sizeof(Bucket*));
+    if (list == NULL)
+        return -1;
+    table->mOldList = table->mListOfBucket;
+    table->mOldSize = table->mSize;
+    table->mMigrated = 0;
+    table->mListOfBucket = list;
+    table->mSize = size;
+    table->mBytes += ALLOC_SIZE(size * sizeof(Bucket*));
+    return 0;
+}
+
+// fonction pour déplacer au plus steps listes de l'ancien tableau dans le nouveau ;
+// l'ancien est libéré quand il est vide
+
+void rehash_step_Htable(Htable* table, size_t steps){
+    if (table->mOldList == NULL)
+        return;
+    for (; steps > 0 && table->mMigrated < table->mOldSize; steps--){
+        Bucket* bucket = table->mOldList[table->mMigrated];
+        table->mOldList[table->mMigrated++] = NULL;
+        while (bucket != NULL){
+            Bucket* next = bucket->mNext;
+            size_t index = Htable_index(table, bucket->mKey, table->mSize);
+            bucket->mNext = table->mListOfBucket[index];
+            table->mListOfBucket[index] = bucket;
+            bucket = next;
+        }
+    }
+    if (table->mMigrated == table->mOldSize){
+        table->mBytes -= ALLOC_SIZE(table->mOldSize * sizeof(Bucket*));
+        free(table->mOldList);
+        table->mOldList = NULL;
+        table->mOldSize = 0;
+        table->mMigrated = 0;
+    }
+}
+
+// fonction pour terminer l'agrandissement en cours (avant de parcourir mListOfBucket)
+
+void finish_rehash_Htable(Htable* table){
+    if (table->mOldList != NULL)
+        rehash_step_Htable(table, table->mOldSize);
+}
+
+// fonction pour vider un hash table sans libérer son tableau de buckets
+// (évite de reconstruire la table entre deux lots)
+
+void clear_Htable(Htable* table){
+    size_t i;
+    finish_rehash_Htable(table);
+    for(i = 0; i < table->mSize; i++){
+        delete_Bucket(table, table->mListOfBucket[i]);
+        table->mListOfBucket[i] = NULL;
+    }
+    table->mCount = 0;
+    table->mRows = 0;
+    table->mBytes = Htable_overhead(table);
+}
+
+// fonction pour changer la taille d'un hash table vide
+// return 0 si réussit, la table reste inchangée sinon
+
+int resize_empty_Htable(Htable* table, size_t size){
+    if (size < 1 || size > UINT_MAX || table->mCount != 0)
+        return -1;
+    Bucket** list = calloc(size, sizeof(Bucket*));
+    if (list == NULL)
+        return -1;
+    finish_rehash_Htable(table);
+    free(table->mListOfBucket);
+    table->mListOfBucket = list;
+    table->mSize = size;
+    table->mBytes = Htable_overhead(table);
+    return 0;
+}
+
+// fonction pour détruire un hash table
+
+void delete_Htable_and_content(Htable* table){
+    finish_rehash_Htable(table);
+    size_t size = table->mSize;
+    size_t i;
+    for(i = 0; i < size; i++)
+        delete_Bucket(table, table->mListOfBucket[i]);
+
+    free(table->mListOfBucket);
+    table->mListOfBucket = NULL;
+
+    free(table);
+    table = NULL;
+}
+
+// fonction pour détruire une liste de buckets
+
+void delete_Bucket(Htable* table, Bucket* bucket){
+    if (bucket == NULL)
+        return;
+    else{
+        Bucket* curr;
+        while((curr = bucket) != NULL){
+            bucket = bucket->mNext;
+            free_Bucket(table, curr);
+            curr = NULL;
+        }
+    }
+}
+
+// fonction pour libérer un bucket, ses valeurs et sa key (selon mOps)
+
+void free_Bucket(Htable* table, Bucket* bucket){
+    const void* const* rows;
+    size_t count = bucket_rows(bucket, &rows), i;
+    if (table->mOps->mFreeValue != NULL)
+        for (i = 0; i < count; i++)
+            table->mOps->mFreeValue((void*)rows[i]);   //cash void* pour éviter le warning
+    if (count > 1)
+        free((void*)((uintptr_t)bucket->mValue & ~(uintptr_t)1));
+    if (table->mOps->mFreeKey != NULL)
+        table->mOps->mFreeKey(bucket->mKey);
+    free(bucket);
+}
+
+// fonction pour retirer une key et toutes ses valeurs
+// return 0 si réussit, -1 si le key n'existe pas
+
+int delete_Htable_key(Htable* table, htable_key key){
+    Bucket** link = NULL;
+    if (table->mOldList != NULL){   // agrandissement en cours : la liste n'est peut-être pas déplacée
+        size_t old = Htable_index(table, key, table->mOldSize);
+        if (old >= table->mMigrated)
+            for (link = &table->mOldList[old]; *link != NULL && !HTABLE_EQUAL(table, key, (*link)->mKey); )
+                link = &(*link)->mNext;
+    }
+    if (link == NULL || *link == NULL)
+        for (link = &table->mListOfBucket[Htable_index(table, key, table->mSize)];
+             *link != NULL && !HTABLE_EQUAL(table, key, (*link)->mKey); )
+            link = &(*link)->mNext;
+    if (*link == NULL)
+        return -1;
+
+    Bucket* bucket = *link;
+    const void* const* rows;
+    size_t count = bucket_rows(bucket, &rows), i, bytes = ALLOC_SIZE(sizeof(Bucket));
+    for (i = 0; i < count; i++)
+        bytes += Htable_value_bytes(table, rows[i]);
+    if (count > 1)
+        bytes += row_list_size(count);
+    *link = bucket->mNext;
+    table->mCount--;
+    table->mRows -= count;
+    table->mBytes -= bytes;
+    free_Bucket(table, bucket);
+    return 0;
+}
+
+// fonction pour ajouter un key et une valeur dans le hash table ; une key déjà
+// présente garde toutes ses valeurs (cf. append_Bucket_value)
+// return 0 si réussit, -1 si on ne peut pas allouer
+
+int add_Htable_value(Htable* table, htable_key key, const void* value){
+    int success;
+    Bucket* bucket = find_Htable_bucket(table, key);   // un ajout n'est pas une recherche comptée
+    if ( bucket == NULL) {                      //ne pas trouver => ajoute nouveau bucket
+        success = add_Bucket(table,key,value);
+    } else {                                    //trouver => ajouter la valeur à celles de la key
+        success = append_Bucket_value(table, bucket, value);
+    }
+    return success;
+}
+
+// fonction pour ajouter count keys et leurs valeurs, dans l'ordre
+// return le nombre ajouté (< count : l'ajout de keys[return] a échoué)
+
+size_t add_Htable_values(Htable* table, const htable_key* keys, const void* const* values, size_t count){
+    size_t i;
+    for (i = 0; i < count; i++)
+        if (0 != add_Htable_value(table, keys[i], values[i]))
+            break;
+    return i;
+}
+
+// fonction qui retourne les octets alloués pour le RowList de count valeurs (count >= 2)
+
+size_t row_list_size(size_t count){
+    size_t capacity = 2;
+    while (capacity < count)
+        capacity *= 2;
+    return ALLOC_SIZE(sizeof(RowList) + capacity * sizeof(void*));
+}
+
+// fonction qui retourne les octets que le RowList d'une key de count valeurs alloue
+// en plus quand on lui en ajoute une
+
+size_t row_list_growth(size_t count){
+    if (count == 1)
+        return row_list_size(2);
+    if (count >= 2 && (count & (count - 1)) == 0)
+        return row_list_size(count + 1) - row_list_size(count);
+    return 0;
+}
+
+// fonction pour ajouter une valeur à un bucket existant : à la 2e valeur, les valeurs
+// passent dans un RowList, dont la capacité double quand il est plein
+// return 0 si réussit, -1 si on ne peut pas allouer (le bucket reste inchangé)
+
+int append_Bucket_value(Htable* table, Bucket* bucket, const void* value){
+    assert(((uintptr_t) value & 1) == 0);     // le bit de poids faible marque les RowList
+    const void* const* rows;
+    size_t count = bucket_rows(bucket, &rows);
+    size_t growth = row_list_growth(count);
+    RowList* list = count == 1 ? NULL : (RowList*)((uintptr_t)bucket->mValue & ~(uintptr_t)1);
+    if (growth > 0){
+        size_t capacity = count == 1 ? 2 : 2 * count;
+        RowList* bigger = realloc(list, sizeof(RowList) + capacity * sizeof(void*));
+        if (bigger == NULL)
+            return -1;
+        if (list == NULL){
+            bigger->mCount = 1;
+            bigger->mRows[0] = bucket->mValue;
+        }
+        list = bigger;
+        bucket->mValue = (const void*)((uintptr_t)list | 1);
+    }
+    list->mRows[list->mCount++] = value;
+    table->mRows++;
+    table->mBytes += growth + Htable_value_bytes(table, value);
+    return 0;
+}
+
+// fonction pour récupérer les valeurs d'un bucket : un seul tableau, dans l'ordre d'ajout
+// return le nombre de valeurs (*rows pointe sur la première)
+
+size_t bucket_rows(const Bucket* bucket, const void* const** rows){
+    if (((uintptr_t)bucket->mValue & 1) == 0){
+        *rows = &bucket->mValue;
+        return 1;
+    }
+    const RowList* list = (const RowList*)((uintptr_t)bucket->mValue & ~(uintptr_t)1);
+    *rows = list->mRows;
+    return list->mCount;
+}
+
+// fonction pour ajouter un nouveau bucket ; le tableau double si la table dépasse
+// HASH_TABLE_LOAD_FACTOR et que le nouveau tableau prend au plus la moitié de ce qui
+// reste sous mGrowLimit (le reste est pour les valeurs ; sinon les listes s'allongent)
+// return 0 si réussit, -1 si on ne peut pas allouer
+
+int add_Bucket(Htable* table, htable_key key, const void* value){
+    assert(((uintptr_t) value & 1) == 0);     // cf. append_Bucket_value
+    size_t entry = ALLOC_SIZE(sizeof(Bucket)) + Htable_value_bytes(table, value);
+    if (table->mGrowLimit > 0 && table->mCount + 1 > HASH_TABLE_LOAD_FACTOR * table->mSize
+        && table->mBytes + 2 * ALLOC_SIZE(2 * (size_t) table->mSize * sizeof(Bucket*)) + entry
+           <= table->mGrowLimit)
+        grow_Htable(table);
+    rehash_step_Htable(table, HASH_TABLE_REHASH_STEP);
+
+    Bucket* head = malloc( sizeof(Bucket));
+
+    if (head == NULL)
+        return -1;
+    else {
+        size_t index = Htable_index(table, key, table->mSize);
+        head->mKey = key;
+        head->mValue = value;
+        head->mNext = table->mListOfBucket[index];
+        table->mListOfBucket[index] = head ;
+        table->mCount++;
+        table->mRows++;
+        table->mBytes += entry;
+        return 0;
+    }
+}
+
+// fonction pour récupérer la première valeur à partir d'un key (cf. bucket_rows pour
+// toutes les avoir)
+// return NULL si le key n'existe pas
+
+const void* get_Htable_value(Htable* table, htable_key key){
+    Bucket* bucket = get_Htable_bucket(table, key);
+    const void* const* rows;
+    if (bucket == NULL)
+        return NULL;
+    bucket_rows(bucket, &rows);
+    return rows[0];
+}
+
+//fonction pour récupérer le bucket à partir d'un key
+// (le nombre de buckets comparés va dans l'histogramme de la table)
+// return NULL si le key n'existe pas
+
+Bucket* get_Htable_bucket(Htable* table, htable_key key){
+    size_t length;
+    Bucket* bucket = search_Htable(table, key, &length);
+    COUNT_PROBE(table, length, bucket != NULL);
+    return bucket;
+}
+
+// fonction pour récupérer le bucket d'un key sans compter la recherche dans mProbes
+// (pour ajouter une valeur, ou chercher une key qui n'est pas une sonde du join)
+// return NULL si le key n'existe pas
+
+Bucket* find_Htable_bucket(const Htable* table, htable_key key){
+    size_t length;
+    return search_Htable(table, key, &length);
+}
+
+// fonction qui cherche le bucket d'un key dans l'ancien tableau (pendant un
+// agrandissement) puis dans le nouveau ; *length : le nombre de buckets comparés
+// return NULL si le key n'existe pas
+
+Bucket* search_Htable(const Htable* table, htable_key key, size_t* length){
+    Bucket* bucket;
+    *length = 0;
+    if (table->mOldList != NULL){   // agrandissement en cours : la liste n'est peut-être pas déplacée
+        size_t old = Htable_index(table, key, table->mOldSize);
+        for (bucket = old < table->mMigrated ? NULL : table->mOldList[old]; bucket != NULL; bucket = bucket->mNext){
+            ++*length;
+            if (HTABLE_EQUAL(table, key, bucket->mKey))
+                return bucket;
+        }
+    }
+    size_t index = Htable_index(table, key, table->mSize);
+    for (bucket = table->mListOfBucket[index]; bucket != NULL; bucket = bucket->mNext){
+        ++*length;
+        if (HTABLE_EQUAL(table, key, bucket->mKey))
+            return bucket;
+    }
+    return NULL;
+}
+
+// fonction pour récupérer les buckets de count keys (buckets[i] = NULL si keys[i]
+// n'existe pas) : par groupes de HASH_TABLE_BATCH, toutes les listes sont calculées
+// et demandées au cache avant d'en parcourir une, pour que leurs défauts de cache se
+// recouvrent au lieu de s'enchaîner
+// return le nombre de keys trouvées
+
+size_t get_Htable_buckets(Htable* table, const htable_key* keys, Bucket** buckets, size_t count){
+    size_t index[HASH_TABLE_BATCH];
+    size_t found = 0, i, j;
+    for (i = 0; i < count; i += HASH_TABLE_BATCH){
+        size_t n = count - i < HASH_TABLE_BATCH ? count - i : HASH_TABLE_BATCH;
+        if (table->mOldList != NULL){   // agrandissement en cours : une key à la fois
+            for (j = 0; j < n; j++)
+                found += (buckets[i + j] = get_Htable_bucket(table, keys[i + j])) != NULL;
+            continue;
+        }
+        for (j = 0; j < n; j++){
+            index[j] = Htable_index(table, keys[i + j], table->mSize);
+            HTABLE_PREFETCH(&table->mListOfBucket[index[j]]);
+        }
+        for (j = 0; j < n; j++){
+            buckets[i + j] = table->mListOfBucket[index[j]];
+            if (buckets[i + j] != NULL)
+                HTABLE_PREFETCH(buckets[i + j]);
+        }
+        for (j = 0; j < n; j++){
+            Bucket* bucket = buckets[i + j];
+            size_t length = 0;
+            for (; bucket != NULL; bucket = bucket->mNext){
+                length++;
+                if (HTABLE_EQUAL(table, keys[i + j], bucket->mKey))
+                    break;
+            }
+            COUNT_PROBE(table, length, bucket != NULL);
+            buckets[i + j] = bucket;
+            found += bucket != NULL;
+        }
+    }
+    return found;
+}
+
+// fonction pour appeler visit(bucket, context) sur chaque bucket de la table, sans
+// la modifier : pendant un agrandissement, les listes pas encore déplacées de l'ancien
+// tableau sont parcourues aussi, chaque bucket une seule fois
+
+void foreach_Htable(const Htable* table, void (*visit)(const Bucket*, void*), void* context){
+    const Bucket* bucket;
+    size_t i;
+    for (i = table->mMigrated; table->mOldList != NULL && i < table->mOldSize; i++)
+        for (bucket = table->mOldList[i]; bucket != NULL; bucket = bucket->mNext)
+            visit(bucket, context);
+    for (i = 0; i < table->mSize; i++)
+        for (bucket = table->mListOfBucket[i]; bucket != NULL; bucket = bucket->mNext)
+            visit(bucket, context);
+}
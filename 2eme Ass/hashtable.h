@@ -0,0 +1,118 @@
+// C99 -- table de hachage partagée par csv_join.c, test.c et hashtable_bench.c
+//        (à compiler avec eux : gcc -std=c99 ... hashtable.c ;
+//         -DHTABLE_NO_STATS pour ne pas compter les sondes de get_Htable_bucket)
+//
+// une key est un mot de 64 bits : soit la key elle-même (csv_join encode ses keys de
+// join sur 64 bits), soit un pointeur vers la vraie key (HTABLE_POINTER_KEY), avec des
+// fonctions de hachage et de comparaison données à construct_Htable (cf. HtableOps)
+
+#ifndef HASHTABLE_H
+#define HASHTABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HASH_TABLE_LOAD_FACTOR 0.75
+#define HASH_TABLE_INITIAL_SIZE 1024    // quand la table peut s'agrandir
+#define HASH_TABLE_REHASH_STEP 4        // listes déplacées à chaque ajout pendant un agrandissement
+#define HASH_TABLE_BATCH 16             // keys hachées d'avance par get_Htable_buckets
+// histogramme du nombre de buckets comparés par get_Htable_bucket
+#define HTABLE_PROBE_HISTOGRAM 16       // 0 à 14 buckets, puis 15 et plus
+
+// taille réellement consommée par un malloc(n) : en-tête + arrondi à 16 octets
+#define ALLOC_SIZE(n) ((((n) + sizeof(size_t) + 15) / 16) * 16)
+
+typedef uint64_t htable_key;
+
+// une key qui est un pointeur (chaîne...), et inversement
+#define HTABLE_POINTER_KEY(p) ((htable_key) (uintptr_t) (p))
+#define HTABLE_KEY_POINTER(key) ((void*) (uintptr_t) (key))
+
+// comment la table traite ses keys et ses valeurs ; un champ NULL prend le défaut
+typedef struct {
+    size_t (*mHash)(htable_key);                // NULL : hash_word sur le mot lui-même
+    int (*mEqual)(htable_key, htable_key);      // 1 si égales ; NULL : mots égaux
+    size_t (*mValueBytes)(const void*);         // octets d'une valeur comptés dans mBytes ; NULL : 0
+    void (*mFreeValue)(void*);                  // NULL : la table ne libère pas les valeurs
+    void (*mFreeKey)(htable_key);               // appelé une fois par bucket ; NULL : rien
+} HtableOps;
+
+extern const HtableOps HTABLE_WORD_OPS;     // tous les défauts
+
+// recherches dans une table : combien, combien trouvées, et combien de buckets comparés
+typedef struct {
+    size_t mLookups;
+    size_t mHits;
+    size_t mLengths[HTABLE_PROBE_HISTOGRAM];
+} ProbeCounts;
+
+// Bucket
+// une key a un seul bucket : mValue est sa valeur si elle n'en a qu'une, sinon un
+// RowList marqué par le bit de poids faible (cf. bucket_rows) ; une valeur ajoutée
+// (add_Htable_value(s), add_Bucket, append_Bucket_value) doit donc avoir ce bit à 0,
+// comme un pointeur rendu par malloc (vérifié par assert)
+typedef struct Bucket{
+    htable_key mKey;
+    const void* mValue;
+    struct Bucket* mNext;
+} Bucket;
+
+// valeurs d'une key ajoutée plusieurs fois, dans l'ordre d'ajout : une sonde les
+// parcourt dans un seul tableau
+typedef struct {
+    size_t mCount;
+    const void* mRows[];    // capacité : la puissance de 2 >= mCount
+} RowList;
+
+// Hash table
+typedef struct {
+    unsigned int mSize;
+    unsigned int mOldSize;  // taille de mOldList
+    Bucket** mListOfBucket;
+    size_t mCount;      // nombre de buckets (keys distinctes) dans la table
+    size_t mRows;       // nombre de valeurs dans la table
+    size_t mBytes;      // octets alloués (tableaux + buckets + RowList + mValueBytes des valeurs)
+    size_t mGrowLimit;  // le tableau double tant que mBytes reste sous cette limite
+                        // (0 : taille fixe)
+    Bucket** mOldList;  // ancien tableau pendant un agrandissement, NULL sinon ; ses
+    size_t mMigrated;   //   mMigrated premières listes sont déjà dans mListOfBucket
+    const HtableOps* mOps;  // jamais NULL (cf. construct_Htable)
+    ProbeCounts mProbes;    // recherches par get_Htable_bucket(s) et get_Htable_value depuis
+                            // construct_Htable (clear_Htable les garde ; pas les ajouts)
+} Htable;
+
+//Prototypes
+
+Htable* construct_Htable(size_t size, const HtableOps* ops);
+void clear_Htable(Htable*);
+int resize_empty_Htable(Htable*, size_t);
+size_t Htable_overhead(const Htable*);
+int grow_Htable(Htable*);
+void rehash_step_Htable(Htable*, size_t);
+void finish_rehash_Htable(Htable*);
+void delete_Htable_and_content(Htable*);
+void delete_Bucket(Htable*, Bucket*);
+int delete_Htable_key(Htable*, htable_key);
+int add_Htable_value(Htable*, htable_key, const void*);
+size_t add_Htable_values(Htable*, const htable_key*, const void* const*, size_t);
+int add_Bucket(Htable*, htable_key, const void*);
+size_t row_list_size(size_t);
+size_t row_list_growth(size_t);
+int append_Bucket_value(Htable*, Bucket*, const void*);
+size_t bucket_rows(const Bucket*, const void* const**);
+const void* get_Htable_value(Htable*, htable_key);
+Bucket* get_Htable_bucket(Htable*, htable_key);
+Bucket* find_Htable_bucket(const Htable*, htable_key);
+size_t get_Htable_buckets(Htable*, const htable_key*, Bucket**, size_t);
+void foreach_Htable(const Htable*, void (*)(const Bucket*, void*), void*);
+size_t Htable_index(const Htable*, htable_key, size_t);
+size_t Htable_value_bytes(const Htable*, const void*);
+void count_probe(ProbeCounts*, size_t, int);
+
+size_t hash_bytes(const char*, size_t);
+size_t hash_function(const char*, size_t);
+size_t hash_word(htable_key, size_t);
+size_t hash_string_key(htable_key);
+int equal_string_keys(htable_key, htable_key);
+
+#endif
@@ -0,0 +1,386 @@
+// C99 -- gcc -std=c99 -O2 hashtable_bench.c hashtable.c -o hashtable_bench
+//
+// mesure la table de hachage de hashtable.c : débit des ajouts, des recherches de keys
+// présentes (une par une, puis par lots avec get_Htable_buckets), de keys absentes et
+// des retraits, pour chaque nombre de keys et chaque taux de remplissage (keys par
+// liste), avec des keys mots (comme csv_join) ou chaînes (comme test.c) ; écrit une
+// ligne CSV par mesure
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hashtable.h"
+
+#define MICRO_MAX_LIST 32           // tailles, taux ou types de keys
+#define MICRO_BATCH 1024            // keys par appel de get_Htable_buckets
+#define MICRO_KEY_SIZE 24           // une key chaîne : 16 chiffres hexadécimaux + '\0'
+#define MICRO_DEFAULT_REPEATS 3
+
+typedef enum { KEYS_WORD, KEYS_STRING } MicroKeys;
+
+typedef enum { OP_INSERT, OP_HIT, OP_HIT_BATCH, OP_MISS, OP_DELETE, OP_COUNT } Operation;
+
+// keys d'une mesure : mCount keys ajoutées, les mêmes dans un autre ordre pour les
+// recherches et les retraits (des copies pour les chaînes, comparées par strcmp), et
+// mCount keys absentes
+typedef struct {
+    size_t mCount;
+    MicroKeys mType;
+    htable_key* mHits;
+    htable_key* mProbes;
+    htable_key* mMisses;
+    char* mStrings;         // les chaînes des trois tableaux (KEYS_STRING)
+} KeySet;
+
+// meilleur temps de chaque opération sur les répétitions
+typedef struct {
+    double mSeconds[OP_COUNT];
+    double mProbeLength[OP_COUNT];  // buckets comparés par recherche, -1 sans statistiques
+    size_t mBuckets;                // taille du tableau après les ajouts
+} Result;
+
+//Prototypes
+
+uint64_t mix64(uint64_t);
+double now_seconds(void);
+int parse_count(const char*, uint64_t*);
+int parse_load(const char*, double*);
+int parse_keys(const char*, MicroKeys*);
+size_t split_list(char*, char*[]);
+int init_KeySet(KeySet*, size_t, MicroKeys, uint64_t);
+void free_KeySet(KeySet*);
+double probe_length(const ProbeCounts*, const ProbeCounts*);
+int bench_table(const KeySet*, double, Result*);
+void usage(const char*);
+
+const char* OPERATION_NAMES[OP_COUNT] = { "insert", "hit", "hit_batch", "miss", "delete" };
+
+// keys chaînes : la table ne les libère pas, elles sont dans KeySet.mStrings
+const HtableOps STRING_KEY_OPS = { hash_string_key, equal_string_keys, NULL, NULL, NULL };
+
+/* ======================================================================
+ * Part I -- Keys and parameters
+ * ======================================================================
+ */
+
+// fonction qui mélange les bits d'un mot (finaliseur de splitmix64, bijectif)
+
+uint64_t mix64(uint64_t x){
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+double now_seconds(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// fonction pour lire un nombre, suivi ou non de K, M ou G (puissances de 1024)
+// return 0 si réussit
+
+int parse_count(const char* s, uint64_t* v){
+    char* end = NULL;
+    unsigned long long value = strtoull(s, &end, 10);
+    if (*s == '\0' || *s == '-' || end == s)
+        return -1;
+    switch (*end){
+    case 'G': case 'g': value <<= 10;   // fall through
+    case 'M': case 'm': value <<= 10;   // fall through
+    case 'K': case 'k': value <<= 10;
+        end++;
+        break;
+    default:
+        break;
+    }
+    if (*end != '\0' || value == 0)
+        return -1;
+    *v = value;
+    return 0;
+}
+
+// fonction pour lire un taux de remplissage : un réel > 0, ou "grow" (rendu comme 0)
+// pour une table qui part de HASH_TABLE_INITIAL_SIZE et double au-delà de
+// HASH_TABLE_LOAD_FACTOR
+// return 0 si réussit
+
+int parse_load(const char* s, double* v){
+    char* end = NULL;
+    if (0 == strcmp(s, "grow")){
+        *v = 0;
+        return 0;
+    }
+    *v = strtod(s, &end);
+    return (end == s || *end != '\0' || !(*v > 0)) ? -1 : 0;
+}
+
+// return 0 si réussit
+
+int parse_keys(const char* s, MicroKeys* type){
+    if (0 == strcmp(s, "word"))        *type = KEYS_WORD;
+    else if (0 == strcmp(s, "string")) *type = KEYS_STRING;
+    else return -1;
+    return 0;
+}
+
+// fonction pour découper une liste "a,b,c" sur place
+// return le nombre d'éléments (au plus MICRO_MAX_LIST), 0 si la liste est trop longue
+
+size_t split_list(char* list, char* items[]){
+    size_t count = 0;
+    char* item;
+    for (item = strtok(list, ","); item != NULL; item = strtok(NULL, ",")){
+        if (count == MICRO_MAX_LIST)
+            return 0;
+        items[count++] = item;
+    }
+    return count;
+}
+
+// fonction pour tirer les keys d'une mesure : mix64 est bijectif, donc les keys
+// présentes (arguments pairs) et absentes (impairs) sont toutes distinctes
+// return 0 si réussit, -1 si on ne peut pas allouer
+
+int init_KeySet(KeySet* set, size_t count, MicroKeys type, uint64_t seed){
+    size_t i;
+    memset(set, 0, sizeof(KeySet));
+    set->mCount = count;
+    set->mType = type;
+    set->mHits = malloc(count * sizeof(htable_key));
+    set->mProbes = malloc(count * sizeof(htable_key));
+    set->mMisses = malloc(count * sizeof(htable_key));
+    if (type == KEYS_STRING)
+        set->mStrings = malloc(3 * count * MICRO_KEY_SIZE);
+    if (set->mHits == NULL || set->mProbes == NULL || set->mMisses == NULL
+        || (type == KEYS_STRING && set->mStrings == NULL)){
+        free_KeySet(set);
+        return -1;
+    }
+    for (i = 0; i < count; i++){
+        set->mHits[i] = mix64(seed + 2 * (uint64_t) i);
+        set->mMisses[i] = mix64(seed + 2 * (uint64_t) i + 1);
+    }
+    memcpy(set->mProbes, set->mHits, count * sizeof(htable_key));
+    for (i = count; i > 1; i--){    // mélange de Fisher-Yates
+        size_t j = mix64(seed ^ (uint64_t) i) % i;
+        htable_key swap = set->mProbes[i - 1];
+        set->mProbes[i - 1] = set->mProbes[j];
+        set->mProbes[j] = swap;
+    }
+    if (type == KEYS_STRING){
+        htable_key* lists[3] = { set->mHits, set->mProbes, set->mMisses };
+        size_t l;
+        for (l = 0; l < 3; l++)
+            for (i = 0; i < count; i++){
+                char* s = set->mStrings + (l * count + i) * MICRO_KEY_SIZE;
+                snprintf(s, MICRO_KEY_SIZE, "%016" PRIx64, lists[l][i]);
+                lists[l][i] = HTABLE_POINTER_KEY(s);
+            }
+    }
+    return 0;
+}
+
+void free_KeySet(KeySet* set){
+    free(set->mHits);
+    free(set->mProbes);
+    free(set->mMisses);
+    free(set->mStrings);
+    memset(set, 0, sizeof(KeySet));
+}
+
+/* ======================================================================
+ * Part II -- Measures
+ * ======================================================================
+ */
+
+// fonction qui retourne le nombre moyen de buckets comparés par les recherches faites
+// entre deux relevés de mProbes
+// return -1 si la table ne compte pas ses sondes (-DHTABLE_NO_STATS)
+
+double probe_length(const ProbeCounts* before, const ProbeCounts* after){
+    size_t lookups = after->mLookups - before->mLookups, i;
+    double buckets = 0;
+    if (lookups == 0)
+        return -1;
+    for (i = 0; i < HTABLE_PROBE_HISTOGRAM; i++)
+        buckets += (double) i * (after->mLengths[i] - before->mLengths[i]);
+    return buckets / lookups;
+}
+
+// fonction pour mesurer une fois chaque opération sur une table de keys / load listes
+// (load 0 : la table s'agrandit) ; les résultats sont vérifiés, et la table doit
+// être vide, mBytes compris, après les retraits
+// return 0 si réussit, -1 en cas d'échec (allocation ou résultat faux)
+
+int bench_table(const KeySet* set, double load, Result* result){
+    size_t n = set->mCount, found = 0, i;
+    size_t size = load > 0 ? (size_t) (n / load) : HASH_TABLE_INITIAL_SIZE;
+    Htable* table = construct_Htable(size > 0 ? size : 1, set->mType == KEYS_STRING ? &STRING_KEY_OPS : NULL);
+    Bucket* buckets[MICRO_BATCH];
+    ProbeCounts before;
+    double start;
+    int success = 0;
+
+    if (table == NULL)
+        return -1;
+    if (load == 0)
+        table->mGrowLimit = SIZE_MAX;
+
+    start = now_seconds();
+    for (i = 0; success == 0 && i < n; i++)
+        success = add_Htable_value(table, set->mHits[i], &set->mHits[i]);
+    finish_rehash_Htable(table);
+    result->mSeconds[OP_INSERT] = now_seconds() - start;
+    result->mProbeLength[OP_INSERT] = -1;
+    result->mBuckets = table->mSize;
+
+    before = table->mProbes;
+    start = now_seconds();
+    for (i = 0; success == 0 && i < n; i++)
+        found += get_Htable_bucket(table, set->mProbes[i]) != NULL;
+    result->mSeconds[OP_HIT] = now_seconds() - start;
+    result->mProbeLength[OP_HIT] = probe_length(&before, &table->mProbes);
+    if (success == 0 && found != n)
+        success = -1;
+
+    found = 0;
+    before = table->mProbes;
+    start = now_seconds();
+    for (i = 0; success == 0 && i < n; i += MICRO_BATCH)
+        found += get_Htable_buckets(table, set->mProbes + i, buckets, n - i < MICRO_BATCH ? n - i : MICRO_BATCH);
+    result->mSeconds[OP_HIT_BATCH] = now_seconds() - start;
+    result->mProbeLength[OP_HIT_BATCH] = probe_length(&before, &table->mProbes);
+    if (success == 0 && found != n)
+        success = -1;
+
+    found = 0;
+    before = table->mProbes;
+    start = now_seconds();
+    for (i = 0; success == 0 && i < n; i++)
+        found += get_Htable_bucket(table, set->mMisses[i]) != NULL;
+    result->mSeconds[OP_MISS] = now_seconds() - start;
+    result->mProbeLength[OP_MISS] = probe_length(&before, &table->mProbes);
+    if (found != 0)
+        success = -1;
+
+    start = now_seconds();
+    for (i = 0; success == 0 && i < n; i++)
+        success = delete_Htable_key(table, set->mProbes[i]);
+    result->mSeconds[OP_DELETE] = now_seconds() - start;
+    result->mProbeLength[OP_DELETE] = -1;
+    if (success == 0 && (table->mCount != 0 || table->mRows != 0 || table->mBytes != Htable_overhead(table)))
+        success = -1;
+
+    delete_Htable_and_content(table);
+    return success;
+}
+
+void usage(const char* program)
+{
+    fprintf(stderr,
+            "usage : %s [-n KEYS] [-l LOADS] [-t TYPES] [-r REPEATS] [-S SEED]\n"
+            "  -n    nombres de keys, séparés par des virgules (1K,64K,1M par défaut ;\n"
+            "        suffixes K, M et G)\n"
+            "  -l    taux de remplissage : keys par liste du tableau, qui garde sa taille,\n"
+            "        ou grow pour partir de %d listes et doubler au-delà de %.2f\n"
+            "        (0.5,0.75,1,2,4,grow par défaut)\n"
+            "  -t    types de keys parmi word (mots de 64 bits) et string (chaînes\n"
+            "        comparées par strcmp) (word,string par défaut)\n"
+            "  -r    répétitions, on garde le meilleur temps (%d par défaut)\n"
+            "  -S    graine des keys\n"
+            "  une ligne CSV par mesure sur la sortie standard : keys, taux, type, listes,\n"
+            "        opération (insert, hit, hit_batch, miss, delete), secondes, millions\n"
+            "        d'opérations par seconde, buckets comparés par recherche (vide si\n"
+            "        compilé avec -DHTABLE_NO_STATS)\n",
+            program, HASH_TABLE_INITIAL_SIZE, HASH_TABLE_LOAD_FACTOR, MICRO_DEFAULT_REPEATS);
+}
+
+int main(int argc, char* argv[])
+{
+    char default_counts[] = "1K,64K,1M", default_loads[] = "0.5,0.75,1,2,4,grow",
+         default_types[] = "word,string";
+    char* count_list = default_counts, *load_list = default_loads, *type_list = default_types;
+    char* counts[MICRO_MAX_LIST], *loads[MICRO_MAX_LIST], *type_names[MICRO_MAX_LIST];
+    uint64_t values[MICRO_MAX_LIST], repeats = MICRO_DEFAULT_REPEATS, seed = 1;
+    double load_values[MICRO_MAX_LIST];
+    MicroKeys types[MICRO_MAX_LIST];
+    size_t count_count, load_count, type_count, i, j, k, r, op;
+    int opt, bad = 0;
+
+    while ((opt = getopt(argc, argv, "n:l:t:r:S:")) != -1) {
+        switch (opt) {
+        case 'n': count_list = optarg; break;
+        case 'l': load_list = optarg; break;
+        case 't': type_list = optarg; break;
+        case 'r': bad |= parse_count(optarg, &repeats); break;
+        case 'S': seed = strtoull(optarg, NULL, 10); break;
+        default: bad = 1;
+        }
+    }
+    count_count = split_list(count_list, counts);
+    load_count = split_list(load_list, loads);
+    type_count = split_list(type_list, type_names);
+    for (i = 0; i < count_count; i++)
+        bad |= parse_count(counts[i], &values[i]);
+    for (i = 0; i < load_count; i++)
+        bad |= parse_load(loads[i], &load_values[i]);
+    for (i = 0; i < type_count; i++)
+        bad |= parse_keys(type_names[i], &types[i]);
+    if (bad || optind != argc || count_count == 0 || load_count == 0 || type_count == 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int failures = 0;
+    printf("keys,load,key_type,buckets,operation,seconds,mops_per_s,probe_length\n");
+    for (k = 0; k < type_count; k++){
+        for (i = 0; i < count_count; i++){
+            KeySet set;
+            if (0 != init_KeySet(&set, values[i], types[k], seed)){
+                fprintf(stderr, "Impossible d'allouer %s keys\n", counts[i]);
+                failures++;
+                continue;
+            }
+            for (j = 0; j < load_count; j++){
+                Result best, result;
+                int success = 0;
+                memset(&best, 0, sizeof(Result));
+                for (r = 0; success == 0 && r < repeats; r++){
+                    success = bench_table(&set, load_values[j], &result);
+                    for (op = 0; op < OP_COUNT; op++)
+                        if (r == 0 || result.mSeconds[op] < best.mSeconds[op])
+                            best.mSeconds[op] = result.mSeconds[op];
+                    memcpy(best.mProbeLength, result.mProbeLength, sizeof(best.mProbeLength));
+                    best.mBuckets = result.mBuckets;
+                }
+                if (success != 0){
+                    fprintf(stderr, "Échec de la mesure : %s keys, taux %s, keys %s\n",
+                            counts[i], loads[j], type_names[k]);
+                    failures++;
+                    continue;
+                }
+                for (op = 0; op < OP_COUNT; op++){
+                    printf("%zu,%s,%s,%zu,%s,%.6f,%.2f,", set.mCount, loads[j], type_names[k], best.mBuckets,
+                           OPERATION_NAMES[op], best.mSeconds[op], set.mCount / best.mSeconds[op] / 1e6);
+                    if (best.mProbeLength[op] >= 0)
+                        printf("%.2f", best.mProbeLength[op]);
+                    printf("\n");
+                }
+                fflush(stdout);
+            }
+            free_KeySet(&set);
+        }
+    }
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
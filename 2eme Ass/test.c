@@ -1,202 +1,311 @@
+// C99 -- gcc -std=c99 test.c hashtable.c -o test
+//
+// vérifie la table de hachage de hashtable.c (keys chaînes et keys mots, valeurs
+// multiples, agrandissement progressif, statistiques des recherches) ; affiche les
+// vérifications qui échouent et retourne 1 s'il y en a une
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <assert.h>
-
-#define HASH_TABLE_LOAD_FACTOR 0.75
+#include <stdint.h>
 
-#define CSV_MAX_LINE_SIZE 1024
-#define CSV_SEPARATOR ','
+#include "hashtable.h"
 
 #define SIZE_OF_HASHTABLE 256
+#define GROW_KEYS 5000          // keys ajoutées à une table de 8 listes : plusieurs agrandissements
 
-// one line (content) in a hashtable
-typedef struct Bucket {
-    const char* mKey;
-    const void* mValue;
-    struct Bucket* mNext;   
-} Bucket;
+// une vérification : compte l'échec et continue (les tests ne dépendent pas de NDEBUG)
+#define CHECK(condition) check((condition) != 0, #condition, __LINE__)
+#define CHECK_PRINTED 20        // échecs affichés, les suivants sont seulement comptés
 
-// hash table
+// valeur de la key k dans les tables à keys mots : non nulle, et paire comme l'exige
+// add_Htable_value (le bit de poids faible marque les RowList, cf. hashtable.h)
+#define WORD_VALUE(k) ((const void*) (uintptr_t) (2 * (k) + 2))
+
+// ce que foreach_Htable a vu
 typedef struct {
-    unsigned int mSize;
-    Bucket** mListOfBucket;
-} Htable;
+	size_t mBuckets;
+	size_t mRows;
+	unsigned char* mSeen;   // keys mots < mKeyCount : nombre de visites de chacune
+	size_t mKeyCount;
+} Visit;
 
 //Prototypes
 
-Htable* construct_Htable(size_t size);
-void delete_Htable_and_content(Htable*);
-void delete_Bucket(Bucket*);
-int add_Htable_value(Htable*, const char*,const void*);
-int add_Bucket(Htable*, const char*, const void*);
-const void* get_Htable_value(Htable*, const char*);
-Bucket* get_Htable_bucket(Htable*, const char*);
-
-size_t hash_function(const char* key, size_t size)
-{
-    size_t hash = 0;
-    size_t key_len = strlen(key);
-    for (size_t i = 0; i < key_len; ++i) {
-        hash += (unsigned char) key[i];
-        hash += (hash << 10);
-        hash ^= (hash >> 6);
-    }
-    hash += (hash << 3);
-    hash ^= (hash >> 11);
-    hash += (hash << 15);
-
-    return hash % size;
+void free_string_key(htable_key);
+char* copy_string(const char*);
+void check(int, const char*, int);
+void visit_bucket(const Bucket*, void*);
+int check_foreach(const Htable*, size_t);
+void test_string_keys(void);
+void test_row_list(void);
+void test_grow_with_rehash(void);
+void test_probe_counts(void);
+
+// keys and values are allocated strings, freed with the table
+const HtableOps STRING_OPS = { hash_string_key, equal_string_keys, NULL, free, free_string_key };
+
+int failures = 0;
+
+void free_string_key(htable_key key){
+	free(HTABLE_KEY_POINTER(key));
 }
 
+// fonction pour copier une chaîne (key ou valeur libérée par la table)
+// return NULL si on ne peut pas allouer
 
-int main (void){
-	Htable* table = construct_Htable(SIZE_OF_HASHTABLE);
-
-	if (table != NULL) {
-		char* key1 = calloc(10, sizeof(char));
-		strcpy(key1, "Suisse");
-		char* key2 = calloc(10, sizeof(char));
-		strcpy(key2, "France");
-		char* key3 = calloc(10, sizeof(char));
-		strcpy(key3, "Vietnam");
-		char* key4 = calloc(10, sizeof(char));
-		strcpy(key4, "China");
-		char* key5 = calloc(10, sizeof(char));
-		strcpy(key5, "Spain");
-
-		char* value1 = calloc(10, sizeof(char));
-		strcpy(value1, "Bern");
-		char* value2 = calloc(10, sizeof(char));
-		strcpy(value2, "Paris");
-		char* value3 = calloc(10, sizeof(char));
-		strcpy(value3, "Hanoi");
-		char* value4 = calloc(10, sizeof(char));
-		strcpy(value4, "Beking");
-		char* value5 = calloc(10, sizeof(char));
-		strcpy(value5, "Madrid");
-
-		add_Htable_value(table,key1,value1);
-		add_Htable_value(table,key2,value2);
-		add_Htable_value(table,key3,value3);
-		add_Htable_value(table,key4,value4);
-		add_Htable_value(table,key5,value5);
-	
-		printf("%s\n",get_Htable_value(table, key1));
-		printf("%s\n",get_Htable_value(table, key2));
-		printf("%s\n",get_Htable_value(table, key3));
-		printf("%s\n",get_Htable_value(table, key4));
-		printf("%s\n",get_Htable_value(table, key5));
-
-
-		delete_Htable_and_content(table);
-	}
+char* copy_string(const char* s){
+	char* copy = malloc(strlen(s) + 1);
+	if (copy != NULL)
+		strcpy(copy, s);
+	return copy;
+}
 
-	
-	
+// fonction pour compter une vérification qui échoue, et l'afficher
 
+void check(int ok, const char* condition, int line){
+	if (!ok && failures++ < CHECK_PRINTED)
+		fprintf(stderr, "test.c:%d : échec de %s\n", line, condition);
 }
-/* ****************************************
- * TODO : add your own code here.
- * **************************************** */
-
-Htable* construct_Htable(size_t size){
-    if (size < 1)
-        return NULL;
-
-    Htable* table = malloc( sizeof(Htable));
-
-    if (table != NULL){
-        table->mListOfBucket = calloc(size, sizeof(Bucket*));
-        if (table->mListOfBucket == NULL){
-            free(table);
-            table =  NULL;
-        } else {
-            int i;
-            for(i = 0; i < size; i++){
-                table->mListOfBucket[i] = NULL ;
-            }
-            table->mSize = size;
-        }
-    }
-    // table = NULL si on ne peut pas allouer les mémoires
-    return table ;
+
+// fonction pour foreach_Htable : compte les buckets, les valeurs et chaque key
+
+void visit_bucket(const Bucket* bucket, void* context){
+	Visit* visit = context;
+	const void* const* rows;
+	visit->mBuckets++;
+	visit->mRows += bucket_rows(bucket, &rows);
+	if (visit->mSeen != NULL && bucket->mKey < visit->mKeyCount)
+		visit->mSeen[bucket->mKey]++;
 }
 
-void delete_Htable_and_content(Htable* table){
-    size_t size = table->mSize;
-    int i;
-    for (i = 0; i < size; i++)
-        delete_Bucket(table->mListOfBucket[i]);
-   	free(table->mListOfBucket);
-    table->mListOfBucket = NULL;
-    free(table);
-    table = NULL;
+// fonction qui vérifie que foreach_Htable voit chaque bucket d'une table à keys mots
+// (< key_count) une seule fois, dans l'ancien tableau comme dans le nouveau
+// return 0 si c'est le cas
+
+int check_foreach(const Htable* table, size_t key_count){
+	Visit visit = { 0, 0, calloc(key_count, 1), key_count };
+	size_t k;
+	int success = (visit.mSeen != NULL) ? 0 : -1;
+	if (success == 0)
+		foreach_Htable(table, visit_bucket, &visit);
+	for (k = 0; success == 0 && k < key_count; k++)
+		if (visit.mSeen[k] > 1)
+			success = -1;
+	if (visit.mBuckets != table->mCount || visit.mRows != table->mRows)
+		success = -1;
+	free(visit.mSeen);
+	return success;
 }
 
-void delete_Bucket(Bucket* bucket){
-	if (bucket == NULL)
+// keys chaînes : ajout, recherche (par une autre copie de la key), retrait
+
+void test_string_keys(void){
+	static const char* keys[] = { "Suisse", "France", "Vietnam", "China", "Spain" };
+	static const char* values[] = { "Bern", "Paris", "Hanoi", "Beking", "Madrid" };
+	Htable* table = construct_Htable(SIZE_OF_HASHTABLE, &STRING_OPS);
+	size_t i;
+	CHECK(table != NULL);
+	if (table == NULL)
 		return;
-	else {
-		Bucket* curr;
-		while((curr = bucket) != NULL){
-			bucket = bucket->mNext;
-			free(curr->mValue);
-            free(curr->mKey);
-			free(curr);
-			curr = NULL;
-		}
+
+	for (i = 0; i < 5; i++)
+		CHECK(0 == add_Htable_value(table, HTABLE_POINTER_KEY(copy_string(keys[i])), copy_string(values[i])));
+	CHECK(table->mCount == 5 && table->mRows == 5);
+	for (i = 0; i < 5; i++){
+		char key[16];
+		strcpy(key, keys[i]);   // une autre copie : comparée par equal_string_keys
+		const char* value = get_Htable_value(table, HTABLE_POINTER_KEY(key));
+		CHECK(value != NULL && 0 == strcmp(value, values[i]));
 	}
-} 
-
-
-// return 0 si on ne peut pas l'ajouter 1 au contraire
-int add_Htable_value(Htable* table, const char* key,const void* value){
-    int success;
-    Bucket* bucket = get_Htable_bucket(table, key);
-    if ( bucket == NULL) { 						//ne pas trouver
-        success = add_Bucket(table,key,value);
-    } else { 									//juste mis-à-jour sa valeur
-        bucket->mValue = value;
-        success = 1 ;
-    }
-    return success;
+	CHECK(NULL == get_Htable_value(table, HTABLE_POINTER_KEY("Italia")));
+
+	char france[] = "France";
+	CHECK(0 == delete_Htable_key(table, HTABLE_POINTER_KEY(france)));
+	CHECK(-1 == delete_Htable_key(table, HTABLE_POINTER_KEY(france)));
+	CHECK(NULL == get_Htable_value(table, HTABLE_POINTER_KEY(france)));
+	CHECK(table->mCount == 4 && table->mRows == 4);
+
+	delete_Htable_and_content(table);
 }
 
-int add_Bucket(Htable* table, const char* key, const void* value){
-	Bucket* head = malloc( sizeof(Bucket));
+// une key ajoutée plusieurs fois : un seul bucket, ses valeurs dans un RowList marqué,
+// dans l'ordre d'ajout, et comptées dans mBytes
 
-	if(head == NULL)
-		return 0;
-	else {
-		size_t index = hash_function(key, table->mSize);
+void test_row_list(void){
+	Htable* table = construct_Htable(SIZE_OF_HASHTABLE, NULL);
+	const void* const* rows;
+	size_t i;
+	CHECK(table != NULL);
+	if (table == NULL)
+		return;
 
-		head->mKey = key;
-		head->mValue = value;
-		head->mNext = table->mListOfBucket[index];
+	CHECK(0 == add_Htable_value(table, 42, WORD_VALUE(0)));
+	Bucket* bucket = get_Htable_bucket(table, 42);
+	CHECK(bucket != NULL && ((uintptr_t) bucket->mValue & 1) == 0);     // une valeur : pas de RowList
+	for (i = 1; i < 5; i++)
+		CHECK(0 == add_Htable_value(table, 42, WORD_VALUE(i)));
+	CHECK(0 == add_Htable_value(table, 7, WORD_VALUE(7)));
+
+	bucket = get_Htable_bucket(table, 42);
+	CHECK(bucket != NULL && ((uintptr_t) bucket->mValue & 1) == 1);
+	if (bucket != NULL){
+		CHECK(5 == bucket_rows(bucket, &rows));
+		for (i = 0; i < 5; i++)
+			CHECK(rows[i] == WORD_VALUE(i));
+	}
+	CHECK(get_Htable_value(table, 42) == WORD_VALUE(0));
+	CHECK(table->mCount == 2 && table->mRows == 6);
+	CHECK(table->mBytes == Htable_overhead(table) + 2 * ALLOC_SIZE(sizeof(Bucket)) + row_list_size(5));
+	CHECK(0 == check_foreach(table, 64));
 
-		table->mListOfBucket[index] = head ;
+	CHECK(0 == delete_Htable_key(table, 42));
+	CHECK(NULL == get_Htable_bucket(table, 42));
+	CHECK(table->mCount == 1 && table->mRows == 1);
+	CHECK(table->mBytes == Htable_overhead(table) + ALLOC_SIZE(sizeof(Bucket)));
 
-		return 1;
+	delete_Htable_and_content(table);
+}
+
+// ajouts, recherches et retraits pendant que les listes de l'ancien tableau sont
+// déplacées HASH_TABLE_REHASH_STEP par HASH_TABLE_REHASH_STEP
+
+void test_grow_with_rehash(void){
+	Htable* table = construct_Htable(8, NULL);
+	size_t k, j, grows = 0, checked = 0, deleted_old = 0;
+	unsigned char* present = calloc(GROW_KEYS, 1);
+	CHECK(table != NULL && present != NULL);
+	if (table == NULL || present == NULL){
+		if (table != NULL) delete_Htable_and_content(table);
+		free(present);
+		return;
+	}
+	table->mGrowLimit = SIZE_MAX;   // le tableau double sans limite de mémoire
+
+	for (k = 0; k < GROW_KEYS; k++){
+		unsigned int size = table->mSize;
+		CHECK(0 == add_Htable_value(table, k, WORD_VALUE(k)));
+		present[k] = 1;
+		if (table->mSize != size)
+			grows++;
+		if (table->mOldList == NULL)
+			continue;
+
+		// agrandissement en cours : des listes sont encore dans l'ancien tableau
+		CHECK(table->mMigrated < table->mOldSize);
+		CHECK(table->mOldSize * 2 == table->mSize);
+		for (j = 0; j <= k; j++)
+			CHECK(get_Htable_value(table, j) == (present[j] ? WORD_VALUE(j) : NULL));
+		CHECK(0 == check_foreach(table, GROW_KEYS));
+		checked++;
+
+		// une key encore dans une liste pas déplacée : on lui ajoute une valeur, puis on la retire
+		for (j = 0; j < k; j++)
+			if (present[j] && Htable_index(table, j, table->mOldSize) >= table->mMigrated)
+				break;
+		if (j < k){
+			size_t count = table->mCount;
+			CHECK(0 == add_Htable_value(table, j, WORD_VALUE(j)));
+			CHECK(table->mCount == count);      // même bucket, pas de nouvelle key
+			Bucket* bucket = get_Htable_bucket(table, j);
+			const void* const* rows;
+			CHECK(bucket != NULL && 2 == bucket_rows(bucket, &rows));
+			CHECK(0 == delete_Htable_key(table, j));
+			CHECK(NULL == get_Htable_value(table, j));
+			CHECK(-1 == delete_Htable_key(table, j));
+			CHECK(table->mCount == count - 1);
+			present[j] = 0;
+			deleted_old++;
+		}
 	}
+	CHECK(grows >= 5);
+	CHECK(checked > 0 && deleted_old > 0);
+
+	// les keys retirées peuvent revenir ; à la fin, tout est dans le nouveau tableau
+	for (k = 0; k < GROW_KEYS; k++)
+		if (!present[k]){
+			CHECK(0 == add_Htable_value(table, k, WORD_VALUE(k)));
+			present[k] = 1;
+		}
+	finish_rehash_Htable(table);
+	CHECK(table->mOldList == NULL && table->mMigrated == 0);
+	CHECK(table->mCount == GROW_KEYS && table->mRows == GROW_KEYS);
+	CHECK(table->mBytes == Htable_overhead(table) + GROW_KEYS * ALLOC_SIZE(sizeof(Bucket)));
+	for (k = 0; k < GROW_KEYS; k++)
+		CHECK(get_Htable_value(table, k) == WORD_VALUE(k));
+	CHECK(0 == check_foreach(table, GROW_KEYS));
+
+	for (k = 0; k < GROW_KEYS; k += 2)
+		CHECK(0 == delete_Htable_key(table, k));
+	CHECK(table->mCount == GROW_KEYS / 2);
+	for (k = 0; k < GROW_KEYS; k++)
+		CHECK(get_Htable_value(table, k) == (k % 2 == 0 ? NULL : WORD_VALUE(k)));
+
+	delete_Htable_and_content(table);
+	free(present);
 }
 
-const void* get_Htable_value(Htable* table, const char* key){
-    Bucket* bucket = get_Htable_bucket(table, key);
-    if (bucket == NULL)
-        return NULL;
-    else
-        return bucket->mValue; 
+// les recherches comptées dans mProbes : une par get_Htable_bucket (et par
+// get_Htable_value), une par key de get_Htable_buckets ; ni les ajouts ni
+// find_Htable_bucket ; rien avec HTABLE_NO_STATS
+
+void test_probe_counts(void){
+	htable_key keys[40];
+	const void* values[40];
+	Bucket* buckets[40];
+	size_t i, total = 0;
+	Htable* table = construct_Htable(SIZE_OF_HASHTABLE, NULL);
+	CHECK(table != NULL);
+	if (table == NULL)
+		return;
+
+	for (i = 0; i < 20; i++){
+		keys[i] = 1000 + i;
+		values[i] = WORD_VALUE(i);
+	}
+	CHECK(20 == add_Htable_values(table, keys, values, 20));
+	for (i = 0; i < 20; i++)
+		CHECK(find_Htable_bucket(table, keys[i]) != NULL);
+	ProbeCounts before = table->mProbes;
+
+	for (i = 0; i < 20; i++)
+		CHECK(get_Htable_bucket(table, keys[i]) != NULL);       // 20 trouvées
+	for (i = 0; i < 10; i++)
+		CHECK(get_Htable_value(table, 5000 + i) == NULL);       // 10 absentes
+	for (i = 0; i < 40; i++)
+		keys[i] = i % 2 == 0 ? 1000 + i / 2 : 9000 + i;         // 20 trouvées, 20 absentes
+	CHECK(20 == get_Htable_buckets(table, keys, buckets, 40));
+	for (i = 0; i < 40; i++)
+		CHECK((buckets[i] != NULL) == (i % 2 == 0));
+
+	const ProbeCounts* counts = &table->mProbes;
+	for (i = 0; i < HTABLE_PROBE_HISTOGRAM; i++)
+		total += counts->mLengths[i] - before.mLengths[i];
+#ifndef HTABLE_NO_STATS
+	CHECK(before.mLookups == 0 && before.mHits == 0);
+	CHECK(counts->mLookups - before.mLookups == 70);
+	CHECK(counts->mHits - before.mHits == 40);
+	CHECK(total == 70);
+	CHECK(counts->mLengths[0] - before.mLengths[0] <= 30);    // une liste vide ne se trouve pas
+#else
+	CHECK(counts->mLookups == 0 && counts->mHits == 0 && total == 0);
+#endif
+
+	clear_Htable(table);    // garde les statistiques
+	CHECK(table->mCount == 0 && table->mProbes.mLookups == counts->mLookups);
+	delete_Htable_and_content(table);
 }
 
-Bucket* get_Htable_bucket(Htable* table, const char* key){
-    Bucket* bucket, *next;
-    size_t index = hash_function(key, table->mSize);
-    bucket = table->mListOfBucket[index];
-    for (; bucket != NULL; bucket = next){
-        if (0 == strcmp(key, bucket->mKey))
-            return bucket ;
-        next = bucket->mNext;
-    }
-    return NULL;
+int main (void){
+	test_string_keys();
+	test_row_list();
+	test_grow_with_rehash();
+	test_probe_counts();
+
+	if (failures > 0){
+		fprintf(stderr, "%d vérification(s) en échec\n", failures);
+		return 1;
+	}
+	printf("tous les tests de la table de hachage réussissent\n");
+	return 0;
 }